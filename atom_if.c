@@ -22,16 +22,26 @@ AtomHDMI. If not, see <https://www.gnu.org/licenses/>.
 
 #include "atom_if.h"
 
+#include <assert.h>
+
 volatile uint16_t _Alignas(EB_BUFFER_LENGTH * 2) _eb_memory[EB_BUFFER_LENGTH] __attribute__((section(".uninitialized_dma_buffer")));
 
-#define EB_EVENT_QUEUE_BITS 7
 #define EB_EVENT_QUEUE_LEN ((1 << EB_EVENT_QUEUE_BITS) / __SIZEOF_INT__)
 
+static_assert(EB_EVENT_QUEUE_BITS >= 4 && EB_EVENT_QUEUE_BITS <= 15,
+              "the DMA can only wrap rings of 16 bytes to 32 KB");
+
 static volatile _Alignas(1 << EB_EVENT_QUEUE_BITS) uint32_t eb_event_queue[EB_EVENT_QUEUE_LEN] = {0};
+// eb2_notify numbers the events from 0, and each event's number is put here
+// at the same index as its address, just before it
+static volatile _Alignas(1 << EB_EVENT_QUEUE_BITS) uint32_t eb_event_seq[EB_EVENT_QUEUE_LEN];
+static struct eb_event_reader eb_reader;
 static PIO eb_pio;
 static uint eb2_address_sm = 0;
 static uint eb2_access_sm = 1;
 static uint eb2_address_sm_offset;
+static PIO eb_notify_pio;
+static uint eb2_notify_sm;
 uint eb_event_chan;
 
 static void eb2_address_program_init(PIO pio, uint sm, bool r65c02mode)
@@ -119,6 +129,24 @@ static void eb2_access_program_init(PIO pio, int sm)
     pio_sm_exec(pio, sm, pio_encode_nop() | pio_encode_sideset_opt(3, 0x7));
 }
 
+static void eb2_notify_program_init(PIO pio, int sm)
+{
+    int offset;
+
+    offset = pio_add_program(pio, &eb2_notify_program);
+    hard_assert(offset >= 0);
+
+    pio_sm_config c = eb2_notify_program_get_default_config(offset);
+    pio_sm_init(pio, sm, offset, &c);
+    // the first event is numbered 0, as _eb_ring_init() expects. X keeps its
+    // value over pio_sm_init(), so it is set rather than left as at reset.
+    pio_sm_exec(pio, sm, pio_encode_set(pio_x, 0));
+    // events between IRQs, held in the OSR
+    pio_sm_put(pio, sm, EB_EVENT_COALESCE - 1);
+    pio_sm_exec(pio, sm, pio_encode_pull(false, true));
+    pio_sm_exec(pio, sm, pio_encode_mov(pio_y, pio_osr));
+}
+
 static void eb_setup_dma(PIO pio, int eb2_address_sm,
                          int eb2_access_sm)
 {
@@ -126,6 +154,7 @@ static void eb_setup_dma(PIO pio, int eb2_address_sm,
     uint read_data_chan = dma_claim_unused_channel(true);
     uint address_chan2 = dma_claim_unused_channel(true);
     uint write_data_chan = dma_claim_unused_channel(true);
+    uint notify_chan = dma_claim_unused_channel(true);
     eb_event_chan = dma_claim_unused_channel(true);
 
     dma_channel_config c;
@@ -186,7 +215,6 @@ static void eb_setup_dma(PIO pio, int eb2_address_sm,
     channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
     channel_config_set_read_increment(&c, false);
     channel_config_set_write_increment(&c, false);
-    channel_config_set_chain_to(&c, eb_event_chan);
     dma_channel_configure(
         write_data_chan,
         &c,
@@ -195,13 +223,36 @@ static void eb_setup_dma(PIO pio, int eb2_address_sm,
         1,
         false);
 
-    // Updates the event queue
+    // Copies the number of each write to an address with the notify flag to
+    // the event numbers. Nothing else raises an event, so writes that no one
+    // handles do not interrupt.
+    _eb_ring_init(eb_event_seq, EB_EVENT_QUEUE_LEN, &eb_reader);
+    c = dma_channel_get_default_config(notify_chan);
+    channel_config_set_high_priority(&c, true);
+    channel_config_set_dreq(&c, pio_get_dreq(eb_notify_pio, eb2_notify_sm, false));
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, EB_EVENT_QUEUE_BITS);
+    channel_config_set_chain_to(&c, eb_event_chan);
+
+    dma_channel_configure(
+        notify_chan,
+        &c,
+        &eb_event_seq,
+        &eb_notify_pio->rxf[eb2_notify_sm],
+        1,
+        true);
+
+    // Updates the event queue, write_data_chan still has the address as the
+    // next 6502 cycle is a microsecond away
     c = dma_channel_get_default_config(eb_event_chan);
     channel_config_set_high_priority(&c, true);
     channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
     channel_config_set_read_increment(&c, false);
     channel_config_set_write_increment(&c, true);
     channel_config_set_ring(&c, true, EB_EVENT_QUEUE_BITS);
+    channel_config_set_chain_to(&c, notify_chan);
     dma_channel_configure(
         eb_event_chan,
         &c,
@@ -215,9 +266,15 @@ void eb_init(PIO pio) //, irq_handler_t handler)
 {
     bool r65c02mode = (watchdog_hw->scratch[0] == EB_65C02_MAGIC_NUMBER);
     eb_pio = pio;
+    // eb2_access raises its notify IRQ in the next PIO up
+    hard_assert(pio_get_index(pio) + 1 < NUM_PIOS);
+    eb_notify_pio = PIO_INSTANCE(pio_get_index(pio) + 1);
+    eb2_notify_sm = pio_claim_unused_sm(eb_notify_pio, true);
     eb2_address_program_init(eb_pio, eb2_address_sm, r65c02mode);
     eb2_access_program_init(eb_pio, eb2_access_sm);
+    eb2_notify_program_init(eb_notify_pio, eb2_notify_sm);
     eb_setup_dma(eb_pio, eb2_address_sm, eb2_access_sm);
+    pio_sm_set_enabled(eb_notify_pio, eb2_notify_sm, true);
     pio_enable_sm_mask_in_sync(eb_pio, 1u << eb2_address_sm | 1u << eb2_access_sm);
 }
 
@@ -244,6 +301,16 @@ bool eb_resume()
 
 void eb_set_exclusive_handler(irq_handler_t handler)
 {
+#if EB_EVENT_COALESCE > 1
+    // eb2_notify raises its IRQ 0 every EB_EVENT_COALESCE events. This can
+    // be just before DMA has put the last of them in the ring, which is then
+    // left for the next call of the handler.
+    const uint irq = pio_get_irq_num(eb_notify_pio, 0);
+    irq_set_exclusive_handler(irq, handler);
+    irq_set_enabled(irq, true);
+    irq_set_priority(irq, PICO_DEFAULT_IRQ_PRIORITY/2);
+    pio_set_irq0_source_enabled(eb_notify_pio, pis_interrupt0, true);
+#else
     irq_set_exclusive_handler(DMA_IRQ_1, handler);
     //irq_add_shared_handler(DMA_IRQ_1, handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
 
@@ -256,27 +323,45 @@ void eb_set_exclusive_handler(irq_handler_t handler)
     // Configure the processor to run dma_handler() when DMA IRQ 1 is asserted
     dma_hw->ints1 = 1u << eb_event_chan;
     dma_hw->inte1 = 1u << eb_event_chan;
+#endif
 }
 
-int eb_get_event()
+void __not_in_flash_func(eb_ack_event_irq)()
 {
-    static volatile uint32_t *out_ptr = &eb_event_queue[0];
-    uint32_t *in_ptr = (uint32_t *)dma_channel_hw_addr(eb_event_chan)->write_addr;
+#if EB_EVENT_COALESCE > 1
+    pio_interrupt_clear(eb_notify_pio, 0);
+#else
+    dma_hw->intr = 1u << eb_event_chan;
+#endif
+}
 
-    int result;
-    if (out_ptr == in_ptr)
-    {
-        result = -1;
-    }
-    else
-    {
-        result = *out_ptr;
-        out_ptr++;
-        if (out_ptr > &eb_event_queue[EB_EVENT_QUEUE_LEN - 1])
-        {
-            // wrap out_ptr
-            out_ptr = &eb_event_queue[0];
-        }
-    }
-    return result;
+/// @brief the index in the ring the event DMA will write next
+static inline uint32_t eb_event_write_index()
+{
+    return dma_channel_hw_addr(eb_event_chan)->write_addr >> 2;
+}
+
+int __not_in_flash_func(eb_get_event)()
+{
+    return _eb_ring_get(eb_event_queue, eb_event_seq, EB_EVENT_QUEUE_LEN,
+                        &eb_reader, eb_event_write_index);
+}
+
+void eb_get_event_stats(struct eb_event_stats *stats)
+{
+    *stats = eb_reader.stats;
+}
+
+void eb_print_event_stats()
+{
+    const struct eb_event_stats s = eb_reader.stats;
+    eb_reader.stats.peak_depth = 0;
+    printf("bus events %lu, dropped %lu, peak depth %lu of %d\n",
+           (unsigned long)s.events, (unsigned long)s.dropped,
+           (unsigned long)s.peak_depth, EB_EVENT_QUEUE_LEN);
+}
+
+void eb_set_drop_handler(eb_drop_handler_t handler)
+{
+    eb_reader.on_drop = handler;
 }
@@ -29,6 +29,7 @@ Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
 #include "hardware/watchdog.h"
 #include "hardware/clocks.h"
 #include "sm.pio.h"
+#include "eb_event_ring.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -42,9 +43,26 @@ Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
 #define PIA_ADDR 0xB000
 
 
-#define _EB_WRITE_FLAG 0b010
-#define _EB_READ_FLAG 0b001
-#define _EB_READ_SNOOP_FLAG 0b100
+// The order of the flags is the order sm.pio reads them in
+#define _EB_WRITE_FLAG 0b0010
+#define _EB_READ_FLAG 0b0001
+#define _EB_NOTIFY_FLAG 0b0100
+#define _EB_READ_SNOOP_FLAG 0b1000
+
+// Bytes in the ring that 6502 write events are put in by DMA, a power of 2
+// with four bytes to an event. A longer burst of writes than fits before the
+// events are read loses the oldest, which eb_get_event() counts and tells
+// the handler set by eb_set_drop_handler() about.
+#ifndef EB_EVENT_QUEUE_BITS
+#define EB_EVENT_QUEUE_BITS 10
+#endif
+
+// The event IRQ is raised for every EB_EVENT_COALESCE events rather than for
+// each one. The events in between have to be picked up by calling the
+// handler from elsewhere, as the SID does each sample.
+#ifndef EB_EVENT_COALESCE
+#define EB_EVENT_COALESCE 1
+#endif
 
 #ifdef __cplusplus
 extern "C"
@@ -61,10 +79,14 @@ enum eb_perm
     EB_PERM_WRITE_ONLY = _EB_WRITE_FLAG,
     EB_PERM_READ_WRITE = (_EB_WRITE_FLAG | _EB_READ_FLAG),
     EB_PERM_READ_SNOOP = _EB_READ_SNOOP_FLAG,
+    // as above, and 6502 writes are put on the event queue
+    EB_PERM_WRITE_NOTIFY = (_EB_WRITE_FLAG | _EB_NOTIFY_FLAG),
+    EB_PERM_READ_WRITE_NOTIFY = (_EB_WRITE_FLAG | _EB_READ_FLAG | _EB_NOTIFY_FLAG),
 };
 
 /// @brief initialise and start the PIO and DMA interface to the 6502 bus
-/// @param pio the pio instance to use
+/// @param pio the pio instance to use, the next one up is also used for
+/// notifying writes so this cannot be the last
 void eb_init(PIO pio);
 
 /// @brief pause the 6502 bus interface
@@ -155,16 +177,111 @@ static inline void eb_set(uint16_t address, unsigned char value)
         *p = value;
 }
 
+// _eb_pack4() uses the DSP extension's UXTB16 and PKHBT where there is one.
+// render_util/eb_block_test sets _EB_PACK4_DSP with C versions of the two to
+// check the DSP path on a host.
+#if !defined(_EB_PACK4_DSP) && defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+#define _EB_PACK4_DSP 1
+
+/// @brief bytes 0 and 2 of a word, zero extended to halfwords
+static inline uint32_t _eb_uxtb16(uint32_t x)
+{
+    uint32_t result;
+    __asm__("uxtb16 %0, %1" : "=r"(result) : "r"(x));
+    return result;
+}
+
+/// @brief the bottom halfword of lo with the bottom halfword of hi above it
+static inline uint32_t _eb_pkhbt(uint32_t lo, uint32_t hi)
+{
+    uint32_t result;
+    __asm__("pkhbt %0, %1, %2, lsl #16" : "=r"(result) : "r"(lo), "r"(hi));
+    return result;
+}
+#endif
+
+/// @brief pack the data bytes of two pairs of memory locations into a word
+/// @param a two locations, data in bytes 0 and 2
+/// @param b the next two locations
+/// @return the four data bytes
+static inline uint32_t _eb_pack4(uint32_t a, uint32_t b)
+{
+#if _EB_PACK4_DSP
+    uint32_t lo = _eb_uxtb16(a);
+    uint32_t hi = _eb_uxtb16(b);
+    lo |= lo >> 8;
+    hi |= hi >> 8;
+    return _eb_pkhbt(lo, hi);
+#else
+    return (a & 0xFF) | ((a >> 8) & 0xFF00) | ((b & 0xFF) << 16) |
+           ((b << 8) & 0xFF000000);
+#endif
+}
+
+/// @brief copy a run of bytes from memory to a packed buffer
+/// @param dst destination buffer, any alignment
+/// @param address 6502 address of source
+/// @param size number of bytes to copy
+static inline void eb_read_block(uint8_t *dst, uint16_t address, size_t size)
+{
+    hard_assert(address + size <= EB_ADDRESS_HIGH);
+    const volatile uint16_t *src = &_eb_memory[address];
+    size_t i = 0;
+    if ((address & 1) && size > 0)
+    {
+        dst[i++] = *src++;
+    }
+    // src is now word aligned, read two locations at a time
+    const volatile uint32_t *s = (const volatile uint32_t *)src;
+    for (; i + 4 <= size; i += 4)
+    {
+        uint32_t w = _eb_pack4(s[0], s[1]);
+        memcpy(dst + i, &w, 4);
+        s += 2;
+    }
+    src = (const volatile uint16_t *)s;
+    for (; i < size; i++)
+    {
+        dst[i] = *src++;
+    }
+}
+
+/// @brief copy a packed buffer to a run of bytes in memory
+/// @param address 6502 destination address
+/// @param src source buffer, any alignment
+/// @param size number of bytes to copy
+static inline void eb_write_block(uint16_t address, const uint8_t *src, size_t size)
+{
+    hard_assert(address + size <= EB_ADDRESS_HIGH);
+    // The data bytes are stored one at a time. Writing whole words would
+    // also write the permission bytes and could undo a 6502 write to the
+    // neighbouring location made by the DMA in the meantime.
+    volatile uint8_t *p = (volatile uint8_t *)&_eb_memory[address];
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+    {
+        uint32_t w;
+        memcpy(&w, src + i, 4);
+        p[0] = w;
+        p[2] = w >> 8;
+        p[4] = w >> 16;
+        p[6] = w >> 24;
+        p += 8;
+    }
+    for (; i < size; i++)
+    {
+        *p = src[i];
+        p += 2;
+    }
+}
+
 /// @brief get a string of chars
 /// @param buffer destination buffer
 /// @param size number of chars to get
 /// @param address 6502 address of source
 static inline void eb_get_chars(char *buffer, size_t size, uint16_t address)
 {
-    for (size_t i = 0; i < size; i++)
-    {
-        buffer[i] = eb_get(address + i);
-    }
+    eb_read_block((uint8_t *)buffer, address, size);
 }
 
 /// @brief copy a string of chars to memory
@@ -173,11 +290,7 @@ static inline void eb_get_chars(char *buffer, size_t size, uint16_t address)
 /// @param size number of chars to copy
 static inline void eb_set_chars(uint16_t address, const char *buffer, size_t size)
 {
-    hard_assert(address + size <= EB_ADDRESS_HIGH);
-    for (size_t i = 0; i < size; i++)
-    {
-        eb_set(address + i, buffer[i]);
-    }
+    eb_write_block(address, (const uint8_t *)buffer, size);
 }
 
 /// @brief copy a null terminated string to memory
@@ -195,9 +308,11 @@ static inline void eb_set_string(uint16_t address, const char *str)
 static inline void eb_memset(uint16_t address, char c, size_t size)
 {
     hard_assert(address + size <= EB_ADDRESS_HIGH);
-    for (size_t i = address; i < address + size; i++)
+    volatile uint8_t *p = (volatile uint8_t *)&_eb_memory[address];
+    for (size_t i = 0; i < size; i++)
     {
-        eb_set(i, c);
+        *p = c;
+        p += 2;
     }
 }
 
@@ -215,10 +330,25 @@ static inline uint eb_get_event_chan()
  */
 void eb_set_exclusive_handler(irq_handler_t handler);
 
+/// @brief clear the event interrupt, first thing in the handler
+void eb_ack_event_irq();
+
 /// @brief get the next 6502 address from the event queue
 /// @return the pico memory address, -1 indicates the queue is empty
 int eb_get_event();
 
+/// @brief get the event counts
+/// @param stats filled in with the counts
+void eb_get_event_stats(struct eb_event_stats *stats);
+
+/// @brief print the event counts and clear the peak depth
+void eb_print_event_stats();
+
+/// @brief set the function called when events are lost, to redraw whatever
+/// they would have changed
+/// @param handler the handler, NULL for none
+void eb_set_drop_handler(eb_drop_handler_t handler);
+
 #ifdef __cplusplus
 }
 #endif
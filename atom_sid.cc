@@ -21,17 +21,21 @@ Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "atom_sid.h"
-#include "resid-0.16/sid.h"
+#include "sid_emu.h"
 #include "hardware/pwm.h"
 #include <hardware/clocks.h>
 #include <math.h>
 #include <stdio.h>
 #include "ui.h"
 #include "teletext.h"
-
-#define C64_CLOCK 1000000
-#define AS_SAMPLE_RATE 50000
-#define AS_TICK_US (C64_CLOCK / AS_SAMPLE_RATE)
+#include "mc6847.h"
+#include "platform.h"
+#include "render_stats.h"
+#include "eb_handlers.h"
+#include "trace.h"
+
+#define AS_SAMPLE_RATE SID_EMU_SAMPLE_RATE
+#define AS_TICK_US SID_EMU_TICK_US
 #define AS_PWM_BITS 11
 #define AS_PWM_WRAP (1 << AS_PWM_BITS)
 
@@ -51,7 +55,6 @@ extern "C" void as_show_status()
     puts("");
 }
 
-SID *sid16 = NULL;
 queue_t as_q;
 
 static void init_dac()
@@ -71,19 +74,25 @@ static void init_dac()
     pwm_set_enabled(audio_pin_slice, true);
 }
 
+static void __not_in_flash_func(sid_write)(uint16_t address, void *)
+{
+    as_sid_write(eb_pico_addr(address));
+}
+
+static void key_write(uint16_t address, void *)
+{
+    ui_post_event(KEY_PRESS, eb_get(address));
+}
+
 extern "C" void __no_inline_not_in_flash_func(sid_event_handler)() {
-    dma_hw->intr = 1u << eb_get_event_chan();
+    eb_ack_event_irq();
     int address = eb_get_event();
     while (address > 0) {
-        int ad65 = eb_6502_addr(address);
-        if (ad65 >= SID_BASE_ADDR && ad65 < (SID_BASE_ADDR + SID_WRITEABLE))
-        {
-            as_sid_write(address);
-        } else if (ad65 == TELETEXT_CRTA || ad65 == TELETEXT_CRTB) {
-            teletext_reg_write(ad65, eb_get(ad65));
-        } else if (ad65 >= 0x100 && ad65 < 0x120) {
-            ui_post_event(KEY_PRESS, eb_get(ad65));
-        }
+        const uint16_t ad65 = eb_6502_addr(address);
+#if BUS_TRACE
+        trace_write(ad65, eb_get(ad65));
+#endif
+        eb_dispatch_write(ad65);
         address = eb_get_event();
     }
 }
@@ -99,27 +108,18 @@ extern "C" void as_init()
     printf("Sample rate: %d/s\n", rate);
     printf("Sample interval: %dus\n", interval);
 
-    sid16 = new SID();
-    sid16->set_chip_model(MOS8580);
-    // sid16->set_chip_model(MOS6581);
-    sid16->reset();
-    // bool ok = sid16->set_sampling_parameters(C64_CLOCK, SAMPLE_INTERPOLATE, AS_SAMPLE_RATE);
-    bool ok = sid16->set_sampling_parameters(C64_CLOCK, SAMPLE_FAST, AS_SAMPLE_RATE);
+    bool ok = sid_emu_init();
     hard_assert(ok);
-    sid16->enable_filter(true);
-    sid16->enable_external_filter(true);
-
-    sid16->input(0);
-    for (int i = 0; i < SID_LEN; i++)
-    {
-        sid16->write(i, 0);
-    }
 
     init_dac();
 
-    eb_set_perm(SID_BASE_ADDR, EB_PERM_WRITE_ONLY, SID_WRITEABLE);
+    eb_set_perm(SID_BASE_ADDR, EB_PERM_WRITE_NOTIFY, SID_WRITEABLE);
     eb_set_perm(SID_BASE_ADDR + SID_WRITEABLE, EB_PERM_READ_ONLY, 4);
-    eb_set_perm(0x100, EB_PERM_WRITE_ONLY, 0x20);
+    eb_set_perm(0x100, EB_PERM_WRITE_NOTIFY, 0x20);
+    ok = eb_register_write_handler(SID_BASE_ADDR, SID_WRITEABLE, sid_write, NULL);
+    hard_assert(ok);
+    ok = eb_register_write_handler(0x100, 0x20, key_write, NULL);
+    hard_assert(ok);
 
     as_update_reg(0x19, 0xFF);
     as_update_reg(0x1A, 0xFF);
@@ -133,7 +133,7 @@ uint16_t debug_buf[500];
 static bool __time_critical_func(as_timer_callback)(repeating_timer_t *)
 {
     // Output current sample
-    int sample = sid16->output(AS_PWM_BITS);
+    int sample = sid_emu_output(AS_PWM_BITS);
     sample = sample + (1 << (AS_PWM_BITS - 1));
     pwm_set_gpio_level(AS_PIN, sample);
     as_element_t el;
@@ -141,29 +141,58 @@ static bool __time_critical_func(as_timer_callback)(repeating_timer_t *)
     {
         if (el.address == 0)
         {
-            for (int i = 0; i < SID_LEN; i++)
-            {
-                sid16->write(i, 0);
-            }
+            sid_emu_clear();
         }
         else
         {
             uint8_t data = el.data;
             uint8_t reg = eb_6502_addr(el.address) & 0x1F;
 
-            sid16->write(reg, data);
+            sid_emu_write(reg, data);
         }
     }
-    sid16->clock(AS_TICK_US);
+#if EB_EVENT_COALESCE > 1
+    // the IRQ leaves up to EB_EVENT_COALESCE - 1 events for here
+    const uint32_t ints = save_and_disable_interrupts();
+    sid_event_handler();
+    restore_interrupts(ints);
+#endif
+    sid_emu_clock();
     // Update the read-only SID regs
-    as_update_reg(0x1B, sid16->read(0x1B));
-    as_update_reg(0x1C, sid16->read(0x1C));    return true;
+    as_update_reg(0x1B, sid_emu_read(0x1B));
+    as_update_reg(0x1C, sid_emu_read(0x1C));    return true;
+}
+
+repeating_timer_t as_timer;
+
+extern "C" void as_run_async()
+{
+    printf("as_run_async()\n");
+    eb_set_exclusive_handler(sid_event_handler);
+
+    bool ok = add_repeating_timer_us(-(int64_t)AS_TICK_US, as_timer_callback, NULL, &as_timer);
+    hard_assert(ok);
 }
 
 extern "C" void as_run()
 {
+#if BUS_TRACE
+    // ui_run() writes the trace to the USB stick a block at a time, which
+    // takes longer than a tick, so the samples come from the timer interrupt
+    // and this loop is left with only the UI and the spare rendering
+    as_run_async();
+    render_stats_init();
+    for (;;)
+    {
+        ui_run();
+#if RENDER_ON_BOTH_CORES
+        mc6847_render_spare(time_us_32() + AS_TICK_US);
+#endif
+    }
+#else
     printf("as_run()\n");
     eb_set_exclusive_handler(sid_event_handler);
+    render_stats_init();
 
     uint32_t last_time = 0;
     for (;;)
@@ -175,16 +204,12 @@ extern "C" void as_run()
         }
         as_timer_callback(NULL);
         ui_run();
+#if RENDER_ON_BOTH_CORES
+        // help render the display with what is left of the tick, this stops
+        // by itself when the SID leaves no time for it
+        while (mc6847_render_spare(cur_time + AS_TICK_US)) {
+        }
+#endif
     }
+#endif
 }
-
-repeating_timer_t as_timer;
-
-extern "C" void as_run_async()
-{
-    printf("as_run_async()\n");
-    eb_set_exclusive_handler(sid_event_handler);
-
-    bool ok = add_repeating_timer_us(-(int64_t)AS_TICK_US, as_timer_callback, NULL, &as_timer);
-    hard_assert(ok);
-}
\ No newline at end of file
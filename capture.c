@@ -7,11 +7,11 @@
 #include "png.h"
 #include "tusb.h"
 
-#define DNAME "/atom"
+#define DNAME CAPTURE_DIR
 #define FILE_PREFIX "scr"
 #define FILE_EXTENSION ".png"
 
-int last_file_number(char* dname) {
+int last_file_number(const char* dname, const char* prefix) {
     int retval = 0;
     DIR dir;
     if (FR_OK != f_opendir(&dir, dname)) {
@@ -24,8 +24,8 @@ int last_file_number(char* dname) {
                 if (fno.fattrib & AM_DIR) {
                     // directory
                 } else {
-                    int len = strlen(FILE_PREFIX);
-                    if (strncmp(FILE_PREFIX, fno.fname, len) == 0) {
+                    int len = strlen(prefix);
+                    if (strncmp(prefix, fno.fname, len) == 0) {
                         int file_number = atoi(fno.fname + len);
                         if (file_number > retval) {
                             retval = file_number;
@@ -213,7 +213,7 @@ void capture() {
     printf("CAPTURE\n");
 
     f_mkdir(DNAME);
-    int fnum = last_file_number(DNAME);
+    int fnum = last_file_number(DNAME, FILE_PREFIX);
     if (fnum < 0) {
         printf("cannot open " DNAME "\n");
         return;
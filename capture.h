@@ -2,6 +2,15 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+// The directory on the USB stick that files are saved in
+#define CAPTURE_DIR "/atom"
+
+/// @brief find the highest numbered file in a directory
+/// @param dname the directory
+/// @param prefix the start of the file names, followed by the number
+/// @return the number, 0 if there are none or -1 if there is no directory
+int last_file_number(const char* dname, const char* prefix);
+
 void capture();
 void capture_task();
 void capture_init();
\ No newline at end of file
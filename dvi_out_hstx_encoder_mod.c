@@ -65,6 +65,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "hardware/structs/hstx_ctrl.h"
 #include "hardware/structs/hstx_fifo.h"
 #include "hardware/structs/sio.h"
+#include "genlock.h"
+#include "hstx_line.h"
 #include "mc6847.h"
 #include "videomode.h"
 //#include "mountains_640x480_rgb332.h"
@@ -72,19 +74,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "pico/sem.h"
 //#define framebuf mountains_640x480
 
-// ----------------------------------------------------------------------------
-// DVI constants
-
-#define TMDS_CTRL_00 0x354u
-#define TMDS_CTRL_01 0x0abu
-#define TMDS_CTRL_10 0x154u
-#define TMDS_CTRL_11 0x2abu
-
-#define SYNC_V0_H0 (TMDS_CTRL_00 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
-#define SYNC_V0_H1 (TMDS_CTRL_01 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
-#define SYNC_V1_H0 (TMDS_CTRL_10 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
-#define SYNC_V1_H1 (TMDS_CTRL_11 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
-
 //#define MODE_H_SYNC_POLARITY 0
 //#define MODE_H_FRONT_PORCH 16
 //#define MODE_H_SYNC_WIDTH 96
@@ -100,15 +89,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define MODE_H_TOTAL_PIXELS                                       \
     (MODE_H_FRONT_PORCH + MODE_H_SYNC_WIDTH + MODE_H_BACK_PORCH + \
      MODE_H_ACTIVE_PIXELS)
-#define MODE_V_TOTAL_LINES                                        \
-    (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + MODE_V_BACK_PORCH + \
-     MODE_V_ACTIVE_LINES)
-
-#define HSTX_CMD_RAW (0x0u << 12)
-#define HSTX_CMD_RAW_REPEAT (0x1u << 12)
-#define HSTX_CMD_TMDS (0x2u << 12)
-#define HSTX_CMD_TMDS_REPEAT (0x3u << 12)
-#define HSTX_CMD_NOP (0xfu << 12)
+#define MODE_V_BLANK_LINES \
+    (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + MODE_V_BACK_PORCH)
+#define MODE_V_TOTAL_LINES (MODE_V_BLANK_LINES + MODE_V_ACTIVE_LINES)
 
 // ----------------------------------------------------------------------------
 // HSTX command lists
@@ -116,33 +99,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // Lists are padded with NOPs to be >= HSTX FIFO size, to avoid DMA rapidly
 // pingponging and tripping up the IRQs.
 
-static uint32_t vblank_line_vsync_off[] = {
-    HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-    SYNC_V1_H1,
-    HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-    SYNC_V1_H0,
-    HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS),
-    SYNC_V1_H1,
-    HSTX_CMD_NOP};
-
-static uint32_t vblank_line_vsync_on[] = {
-    HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-    SYNC_V0_H1,
-    HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-    SYNC_V0_H0,
-    HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS),
-    SYNC_V0_H1,
-    HSTX_CMD_NOP};
-
-static uint32_t vactive_line[] = {HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-                                  SYNC_V1_H1,
-                                  HSTX_CMD_NOP,
-                                  HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-                                  SYNC_V1_H0,
-                                  HSTX_CMD_NOP,
-                                  HSTX_CMD_RAW_REPEAT | MODE_H_BACK_PORCH,
-                                  SYNC_V1_H1,
-                                  HSTX_CMD_TMDS | MODE_H_ACTIVE_PIXELS};
+// A vertical blanking line, made for the video mode by vblank_line()
+#define VBLANK_LINE_WORDS 7
+
+// The vertical blanking is sent as two transfers, the front porch and sync
+// lines, then the back porch lines, made by hstx_main(). Each active line is
+// one transfer of the list from mc6847_get_line_buffer(), which starts with
+// its own horizontal sync. Both are sized for the longest blanking of any
+// mode, see video_mode_usable().
+static uint32_t vblank_sync[MODE_V_MAX_SYNC_LINES * VBLANK_LINE_WORDS];
+#if GENLOCK
+// The back porch is made longer or shorter to follow the Atom's frames, see
+// genlock.h
+#define BACK_PORCH_LINES (MODE_V_MAX_BACK_PORCH + GENLOCK_MAX_LINES)
+#else
+#define BACK_PORCH_LINES MODE_V_MAX_BACK_PORCH
+#endif
+static uint32_t vblank_back_porch[BACK_PORCH_LINES * VBLANK_LINE_WORDS];
 
 // ----------------------------------------------------------------------------
 // DMA logic
@@ -153,16 +126,66 @@ static uint32_t vactive_line[] = {HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
 // First we ping. Then we pong. Then... we ping again.
 static bool dma_pong = false;
 
-// A ping and a pong are cued up initially, so the first time we enter this
-// handler it is to cue up the second ping after the first ping has completed.
-// This is the third scanline overall (-> =2 because zero-based).
-static uint v_scanline = 2;
-
-// During the vertical active period, we take two IRQs per scanline: one to
-// post the command list, and another to post the pixels.
-static bool vactive_cmdlist_posted = false;
+// The front porch and sync lines and then the back porch lines are cued up
+// initially, so the first time we enter this handler it is to cue up the
+// first active line. After that there is one IRQ per active line and two
+// for the vertical blanking, rather than two for every line.
+//
+// A control channel writing each transfer into the ping and pong channels'
+// trigger registers from a list of control blocks could send runs of lines
+// without an IRQ, but the list would have to be made ahead of the scanout.
+// mc6847_get_line_buffer() chooses each line's buffer as it is sent,
+// repeating the last line if the next is late, and asks for lines to be
+// drawn as they are sent, which is what paces the renderer. So runs of
+// identical lines still cost an IRQ each. The vertical blanking needs no
+// control blocks, its lines are contiguous lists sent as one transfer.
+static uint v_scanline;
+
+#if NATIVE_SCANOUT
+// With NATIVE_SCANOUT a line's commands and its pixels are separate
+// transfers, see hstx_line.h. The ping channel always takes the commands and
+// the pong channel the pixels, which are 8 bit transfers for pixels sent
+// twice and 16 bit for pixels sent once, so there are two IRQs per line. The
+// vertical blanking is sent as vblank_sync on ping and vblank_back_porch on
+// pong.
+//
+// The pong channel's next transfer, set up when the ping channel is given
+// the commands that go before it
+static uint32_t pong_ctrl_base;
+static uint32_t pong_ctrl;
+static const void* pong_read;
+static uint pong_count;
+
+static inline void set_pong(const void* read, uint count,
+                            enum dma_channel_transfer_size size) {
+    pong_ctrl = (pong_ctrl_base & ~DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS) |
+                (size << DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB);
+    pong_read = read;
+    pong_count = count;
+}
+#endif
+
+#if GENLOCK
+// The line the falling edge of the Atom's FS should be seen on, where the
+// 6847 picture ends. A line is set up while the one before it is sent.
+#define FS_SETPOINT \
+    (MODE_V_BLANK_LINES + (MODE_V_ACTIVE_LINES + 192 * YSCALE) / 2 - 1)
+
+// lines added to the next back porch
+static int back_porch_adjust = 0;
+#endif
+
+static inline uint back_porch_words() {
+#if GENLOCK
+    return (MODE_V_BACK_PORCH + back_porch_adjust) * VBLANK_LINE_WORDS;
+#else
+    return MODE_V_BACK_PORCH * VBLANK_LINE_WORDS;
+#endif
+}
 
-#define FS_SETPOINT 476
+static inline uint sync_words() {
+    return (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH) * VBLANK_LINE_WORDS;
+}
 
 void __scratch_x("") dma_irq_handler() {
     // dma_pong indicates the channel that just finished, which is the one
@@ -172,55 +195,64 @@ void __scratch_x("") dma_irq_handler() {
     dma_hw->intr = 1u << ch_num;
     dma_pong = !dma_pong;
 
+#if GENLOCK
     static bool fs_previous = true;
-    static int fs_measured = FS_SETPOINT;
-    static int fs_error = 0;
-    bool fs_current = gpio_get(PIN_VSYNC);
-
+    static int fs_line = -1;
+    const bool fs_current = gpio_get(PIN_VSYNC);
     if (fs_previous && !fs_current) {
         // Falling edge of FS has been detected
-        fs_measured = v_scanline;
-        fs_error = fs_measured - FS_SETPOINT;
+        fs_line = v_scanline;
     }
     fs_previous = fs_current;
-    
-    if (v_scanline >= MODE_V_FRONT_PORCH &&
-        v_scanline < (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH)) {
-        ch->read_addr = (uintptr_t)vblank_line_vsync_on;
-        ch->transfer_count = count_of(vblank_line_vsync_on);
-    } else if (v_scanline <
-               MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + MODE_V_BACK_PORCH) {
-        ch->read_addr = (uintptr_t)vblank_line_vsync_off;
-        ch->transfer_count = count_of(vblank_line_vsync_off);
-    } else if (!vactive_cmdlist_posted) {
-        ch->read_addr = (uintptr_t)vactive_line;
-        ch->transfer_count = count_of(vactive_line);
-        vactive_cmdlist_posted = true;
+#endif
+
+#if NATIVE_SCANOUT
+    if (ch_num == DMACH_PONG) {
+        ch->al1_ctrl = pong_ctrl;
+        ch->read_addr = (uintptr_t)pong_read;
+        ch->transfer_count = pong_count;
+        return;
+    }
+#endif
+
+    if (v_scanline >= MODE_V_BLANK_LINES) {
+        uint x = v_scanline - MODE_V_BLANK_LINES;
+        uint words;
+        const uint32_t* line = mc6847_get_line_buffer(x, &words);
+        ch->read_addr = (uintptr_t)line;
+#if NATIVE_SCANOUT
+        const uint cmd_words = words & LINE_WORDS_MASK;
+        ch->transfer_count = cmd_words;
+        set_pong(line + cmd_words,
+                 (line[cmd_words - 1] & HSTX_COUNT_MASK) / 2,
+                 (words & LINE_DOUBLED) ? DMA_SIZE_8 : DMA_SIZE_16);
+#else
+        ch->transfer_count = words;
+#endif
+        v_scanline = (v_scanline + 1) % MODE_V_TOTAL_LINES;
+    } else if (v_scanline == 0) {
+#if GENLOCK
+        back_porch_adjust = genlock_frame(fs_line);
+        fs_line = -1;
+#endif
+        ch->read_addr = (uintptr_t)vblank_sync;
+        ch->transfer_count = sync_words();
+#if NATIVE_SCANOUT
+        set_pong(vblank_back_porch, back_porch_words(), DMA_SIZE_32);
+        v_scanline = MODE_V_BLANK_LINES;
+#else
+        v_scanline = MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH;
+#endif
     } else {
-        uint x = v_scanline -
-                 (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + MODE_V_BACK_PORCH);
-        ch->read_addr = (uintptr_t)mc6847_get_line_buffer(x);
-        ch->transfer_count = MODE_H_ACTIVE_PIXELS / sizeof(uint32_t);
-        vactive_cmdlist_posted = false;
-        if (v_scanline == FS_SETPOINT+1) {
-            if (fs_error > 0) {
-                fs_error = 1;
-            } else if (fs_error < 0) {
-                fs_error = -1;
-            }
-            //v_scanline = v_scanline - fs_error;
-            fs_error = 0;
-        } 
+        ch->read_addr = (uintptr_t)vblank_back_porch;
+        ch->transfer_count = back_porch_words();
+        v_scanline = MODE_V_BLANK_LINES;
     }
 
     // if (v_scanline == MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH) {
     //     // internal vsync
     //     mc6847_get_line_buffer(-1);
     // }
-
-    if (!vactive_cmdlist_posted) {
-        v_scanline = (v_scanline + 1) % MODE_V_TOTAL_LINES;
-    }
 }
 
 // ----------------------------------------------------------------------------
@@ -237,7 +269,61 @@ static __force_inline uint8_t colour_rgb332(uint8_t r, uint8_t g, uint8_t b) {
 
 void scroll_framebuffer(void);
 
+/// @brief make a vertical blanking line for the video mode
+/// @param line filled in with VBLANK_LINE_WORDS words
+/// @param vsync_on the vertical sync is asserted during the line
+static void vblank_line(uint32_t* line, bool vsync_on) {
+    const uint32_t h1 = vsync_on ? SYNC_V0_H1 : SYNC_V1_H1;
+    const uint32_t h0 = vsync_on ? SYNC_V0_H0 : SYNC_V1_H0;
+    const uint32_t words[VBLANK_LINE_WORDS] = {
+        HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
+        h1,
+        HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
+        h0,
+        HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS),
+        h1,
+        HSTX_CMD_NOP};
+    for (uint i = 0; i < VBLANK_LINE_WORDS; i++) {
+        line[i] = words[i];
+    }
+}
+
+static uint32_t* add_vblank_lines(uint32_t* q, const uint32_t* line,
+                                  int count) {
+    for (int i = 0; i < count; i++) {
+        for (uint j = 0; j < VBLANK_LINE_WORDS; j++) {
+            *q++ = line[j];
+        }
+    }
+    return q;
+}
+
 int hstx_main(void) {
+    uint32_t vblank_line_vsync_off[VBLANK_LINE_WORDS];
+    uint32_t vblank_line_vsync_on[VBLANK_LINE_WORDS];
+    vblank_line(vblank_line_vsync_off, false);
+    vblank_line(vblank_line_vsync_on, true);
+    v_scanline = MODE_V_BLANK_LINES;
+
+    uint32_t* q = add_vblank_lines(vblank_sync, vblank_line_vsync_off,
+                                   MODE_V_FRONT_PORCH);
+    add_vblank_lines(q, vblank_line_vsync_on, MODE_V_SYNC_WIDTH);
+    add_vblank_lines(vblank_back_porch, vblank_line_vsync_off,
+                     BACK_PORCH_LINES);
+#if GENLOCK
+    genlock_init(MODE_V_TOTAL_LINES, FS_SETPOINT);
+#endif
+
+#if PACKED_PIXELS
+    // Configure HSTX's TMDS encoder for RGB121, each lane's bits are rotated
+    // to the top of its byte
+    hstx_ctrl_hw->expand_tmds = 0 << HSTX_CTRL_EXPAND_TMDS_L2_NBITS_LSB |
+                                28 << HSTX_CTRL_EXPAND_TMDS_L2_ROT_LSB |
+                                1 << HSTX_CTRL_EXPAND_TMDS_L1_NBITS_LSB |
+                                27 << HSTX_CTRL_EXPAND_TMDS_L1_ROT_LSB |
+                                0 << HSTX_CTRL_EXPAND_TMDS_L0_NBITS_LSB |
+                                25 << HSTX_CTRL_EXPAND_TMDS_L0_ROT_LSB;
+#else
     // Configure HSTX's TMDS encoder for RGB332
     hstx_ctrl_hw->expand_tmds = 2 << HSTX_CTRL_EXPAND_TMDS_L2_NBITS_LSB |
                                 0 << HSTX_CTRL_EXPAND_TMDS_L2_ROT_LSB |
@@ -245,13 +331,27 @@ int hstx_main(void) {
                                 29 << HSTX_CTRL_EXPAND_TMDS_L1_ROT_LSB |
                                 1 << HSTX_CTRL_EXPAND_TMDS_L0_NBITS_LSB |
                                 26 << HSTX_CTRL_EXPAND_TMDS_L0_ROT_LSB;
+#endif
 
-    // Pixels (TMDS) come in 4 8-bit chunks. Control symbols (RAW) are an
-    // entire 32-bit word.
+    // Pixels (TMDS) come in 4 8-bit chunks, 2 with NATIVE_SCANOUT or 8
+    // 4-bit chunks with PACKED_PIXELS.
+    // Control symbols (RAW) are an entire 32-bit word.
+#if NATIVE_SCANOUT
+    hstx_ctrl_hw->expand_shift = 2 << HSTX_CTRL_EXPAND_SHIFT_ENC_N_SHIFTS_LSB |
+                                 8 << HSTX_CTRL_EXPAND_SHIFT_ENC_SHIFT_LSB |
+                                 1 << HSTX_CTRL_EXPAND_SHIFT_RAW_N_SHIFTS_LSB |
+                                 0 << HSTX_CTRL_EXPAND_SHIFT_RAW_SHIFT_LSB;
+#elif PACKED_PIXELS
+    hstx_ctrl_hw->expand_shift = 8 << HSTX_CTRL_EXPAND_SHIFT_ENC_N_SHIFTS_LSB |
+                                 4 << HSTX_CTRL_EXPAND_SHIFT_ENC_SHIFT_LSB |
+                                 1 << HSTX_CTRL_EXPAND_SHIFT_RAW_N_SHIFTS_LSB |
+                                 0 << HSTX_CTRL_EXPAND_SHIFT_RAW_SHIFT_LSB;
+#else
     hstx_ctrl_hw->expand_shift = 4 << HSTX_CTRL_EXPAND_SHIFT_ENC_N_SHIFTS_LSB |
                                  8 << HSTX_CTRL_EXPAND_SHIFT_ENC_SHIFT_LSB |
                                  1 << HSTX_CTRL_EXPAND_SHIFT_RAW_N_SHIFTS_LSB |
                                  0 << HSTX_CTRL_EXPAND_SHIFT_RAW_SHIFT_LSB;
+#endif
 
     // Serial output config: clock period of 5 cycles, pop from command
     // expander every 5 cycles, shift the output shiftreg by 2 every cycle.
@@ -298,23 +398,24 @@ int hstx_main(void) {
         gpio_set_function(i, 0);  // HSTX
     }
 
-    // Both channels are set up identically, to transfer a whole scanline and
-    // then chain to the opposite channel. Each time a channel finishes, we
+    // Both channels are set up identically, to transfer a list of commands
+    // and then chain to the opposite channel. Each time a channel finishes, we
     // reconfigure the one that just finished, meanwhile the opposite channel
     // is already making progress.
     dma_channel_config c;
     c = dma_channel_get_default_config(DMACH_PING);
     channel_config_set_chain_to(&c, DMACH_PONG);
     channel_config_set_dreq(&c, DREQ_HSTX);
-    dma_channel_configure(DMACH_PING, &c, &hstx_fifo_hw->fifo,
-                          vblank_line_vsync_off,
-                          count_of(vblank_line_vsync_off), false);
+    dma_channel_configure(DMACH_PING, &c, &hstx_fifo_hw->fifo, vblank_sync,
+                          sync_words(), false);
     c = dma_channel_get_default_config(DMACH_PONG);
     channel_config_set_chain_to(&c, DMACH_PING);
     channel_config_set_dreq(&c, DREQ_HSTX);
     dma_channel_configure(DMACH_PONG, &c, &hstx_fifo_hw->fifo,
-                          vblank_line_vsync_off,
-                          count_of(vblank_line_vsync_off), false);
+                          vblank_back_porch, back_porch_words(), false);
+#if NATIVE_SCANOUT
+    pong_ctrl_base = channel_config_get_ctrl_value(&c);
+#endif
 
     dma_hw->ints0 = (1u << DMACH_PING) | (1u << DMACH_PONG);
     dma_hw->inte0 = (1u << DMACH_PING) | (1u << DMACH_PONG);
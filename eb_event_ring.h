@@ -0,0 +1,126 @@
+/*
+
+Reading the ring of 6502 write events filled by DMA
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// The DMA writes each event's number and then its address at the same index
+// of two rings of the same length, going round without waiting for them to
+// be read. eb_get_event() in atom_if.c reads them with _eb_ring_get(), which
+// calls the drop handler when the DMA has overwritten events not yet read.
+// Nothing here uses the SDK, so that render_util/event_ring_test can run it
+// on a host computer.
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// @brief counts of the events seen by eb_get_event()
+struct eb_event_stats {
+    uint32_t events;     ///< events read
+    uint32_t dropped;    ///< events overwritten before they were read
+    uint32_t peak_depth; ///< most events waiting to be read
+};
+
+/// @brief called when events have been overwritten before they were read,
+/// from the event IRQ
+/// @param dropped the number of events lost
+typedef void (*eb_drop_handler_t)(uint32_t dropped);
+
+/// @brief the reading side of the rings
+struct eb_event_reader {
+    uint32_t next_seq;  ///< the number of the next event to read
+    struct eb_event_stats stats;
+    eb_drop_handler_t on_drop;  ///< NULL for none
+};
+
+/// @brief start the rings empty, as if they had been filled with the events
+/// before the first, which is numbered 0
+/// @param seq the ring of event numbers
+/// @param len entries in each ring, a power of 2
+/// @param reader the reading side
+static inline void _eb_ring_init(volatile uint32_t* seq, uint32_t len,
+                                 struct eb_event_reader* reader)
+{
+    for (uint32_t i = 0; i < len; i++)
+    {
+        seq[i] = i - len;
+    }
+    reader->next_seq = 0;
+}
+
+/// @brief take the oldest event that has not been overwritten
+/// @param events the ring of event addresses
+/// @param seq the ring of event numbers
+/// @param len entries in each ring, a power of 2
+/// @param reader the reading side
+/// @param write_index gets the index the DMA will write next
+/// @return the event's address, -1 if there are none to read
+static inline int _eb_ring_get(const volatile uint32_t* events,
+                               const volatile uint32_t* seq, uint32_t len,
+                               struct eb_event_reader* reader,
+                               uint32_t (*write_index)(void))
+{
+    const uint32_t mask = len - 1;
+    for (;;)
+    {
+        // the events before the one DMA will write next are complete
+        const uint32_t in = write_index() & mask;
+        const uint32_t latest = seq[(in - 1) & mask];
+        const uint32_t depth = latest + 1 - reader->next_seq;
+        if ((int32_t)depth <= 0)
+        {
+            return -1;
+        }
+        if (depth > reader->stats.peak_depth)
+        {
+            reader->stats.peak_depth = depth;
+        }
+        if (depth > len)
+        {
+            // DMA has been round the ring since, skip to the oldest left
+            const uint32_t dropped = depth - len;
+            reader->stats.dropped += dropped;
+            reader->next_seq = latest + 1 - len;
+            if (reader->on_drop)
+            {
+                reader->on_drop(dropped);
+            }
+        }
+        const uint32_t i = reader->next_seq & mask;
+        const int result = events[i];
+        // DMA writes the number first, so if it is still the one wanted the
+        // address was not overwritten either
+        if (seq[i] == reader->next_seq)
+        {
+            reader->next_seq++;
+            reader->stats.events++;
+            return result;
+        }
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
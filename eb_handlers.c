@@ -0,0 +1,90 @@
+/*
+
+Handlers for 6502 writes, looked up by address
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "eb_handlers.h"
+
+#include <string.h>
+
+// Nothing here uses the SDK, so that the dispatch can be timed on a host
+// computer
+
+static void no_handler(uint16_t address, void* ctx) {}
+
+struct eb_write_handler _eb_write_handlers[EB_WRITE_HANDLER_MAX + 1] = {
+    {no_handler, NULL}};
+uint8_t _eb_handler_pages[256];
+uint8_t _eb_handler_fine[EB_WRITE_HANDLER_FINE_PAGES][256];
+
+static int handler_count;
+static int fine_count;
+
+void eb_clear_write_handlers(void) {
+    handler_count = 0;
+    fine_count = 0;
+    memset(_eb_handler_pages, 0, sizeof(_eb_handler_pages));
+}
+
+bool eb_register_write_handler(uint16_t start, size_t len,
+                               eb_write_handler_t fn, void* ctx) {
+    const uint32_t end = start + len;
+    if (len == 0 || end > 0x10000 || handler_count == EB_WRITE_HANDLER_MAX) {
+        return false;
+    }
+
+    // pages that only part of the window covers need a table of their own
+    const unsigned first_page = start >> 8;
+    const unsigned last_page = (end - 1) >> 8;
+    int fine_needed = 0;
+    for (unsigned page = first_page; page <= last_page; page++) {
+        const bool whole = page * 256 >= start && page * 256 + 256 <= end;
+        if (!whole && !(_eb_handler_pages[page] & _EB_FINE_PAGE)) {
+            fine_needed++;
+        }
+    }
+    if (fine_count + fine_needed > EB_WRITE_HANDLER_FINE_PAGES) {
+        return false;
+    }
+
+    const uint8_t h = ++handler_count;
+    _eb_write_handlers[h] = (struct eb_write_handler){fn, ctx};
+    for (unsigned page = first_page; page <= last_page; page++) {
+        const uint32_t page_start = page * 256;
+        const bool whole = page_start >= start && page_start + 256 <= end;
+        if (whole) {
+            // takes over any fine table the page had, which is not reused
+            _eb_handler_pages[page] = h;
+            continue;
+        }
+        if (!(_eb_handler_pages[page] & _EB_FINE_PAGE)) {
+            // the page's own table starts with its current handler
+            memset(_eb_handler_fine[fine_count], _eb_handler_pages[page], 256);
+            _eb_handler_pages[page] = _EB_FINE_PAGE | fine_count++;
+        }
+        uint8_t* fine = _eb_handler_fine[_eb_handler_pages[page] & ~_EB_FINE_PAGE];
+        for (uint32_t a = page_start; a < page_start + 256; a++) {
+            if (a >= start && a < end) {
+                fine[a & 0xFF] = h;
+            }
+        }
+    }
+    return true;
+}
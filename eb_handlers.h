@@ -0,0 +1,91 @@
+/*
+
+Handlers for 6502 writes, looked up by address
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Each device registers a handler for its window of addresses and the event
+// IRQ hands every write on the event queue to eb_dispatch_write(). The
+// handler for an address is found in a table of the 256 pages of the address
+// space. A page with more than one handler, or with a handler for only some
+// of it, gets one of EB_WRITE_HANDLER_FINE_PAGES tables of its own, so a
+// lookup is at most two loads whatever the number of handlers.
+//
+// Only writes to addresses with a notify permission reach the event queue,
+// see eb_set_perm() in atom_if.h.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EB_WRITE_HANDLER_MAX 32
+#define EB_WRITE_HANDLER_FINE_PAGES 8
+
+// Set in a page's entry when the page has a table of its own
+#define _EB_FINE_PAGE 0x80
+
+/// @brief handles a 6502 write
+/// @param address the 6502 address written to, the data is in memory
+/// @param ctx as given to eb_register_write_handler()
+typedef void (*eb_write_handler_t)(uint16_t address, void* ctx);
+
+struct eb_write_handler {
+    eb_write_handler_t fn;
+    void* ctx;
+};
+
+// Entry 0 does nothing, for addresses with no handler
+extern struct eb_write_handler _eb_write_handlers[EB_WRITE_HANDLER_MAX + 1];
+extern uint8_t _eb_handler_pages[256];
+extern uint8_t _eb_handler_fine[EB_WRITE_HANDLER_FINE_PAGES][256];
+
+/// @brief set the handler for a window of addresses, replacing any handler
+/// registered earlier for those addresses
+/// @param start first 6502 address
+/// @param len number of addresses
+/// @param fn the handler
+/// @param ctx passed to the handler
+/// @return false if there are already EB_WRITE_HANDLER_MAX handlers, or the
+/// window needs more fine pages than are left
+bool eb_register_write_handler(uint16_t start, size_t len,
+                               eb_write_handler_t fn, void* ctx);
+
+/// @brief remove every handler
+void eb_clear_write_handlers(void);
+
+/// @brief call the handler for a 6502 write
+/// @param address the 6502 address written to
+static inline void eb_dispatch_write(uint16_t address) {
+    uint8_t h = _eb_handler_pages[address >> 8];
+    if (h & _EB_FINE_PAGE) {
+        h = _eb_handler_fine[h & ~_EB_FINE_PAGE][address & 0xFF];
+    }
+    const struct eb_write_handler* w = &_eb_write_handlers[h];
+    w->fn(address, w->ctx);
+}
+
+#ifdef __cplusplus
+}
+#endif
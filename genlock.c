@@ -0,0 +1,119 @@
+/*
+
+Frame genlock to the Atom's field sync
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "genlock.h"
+
+#include <stdio.h>
+
+// Nothing here uses the SDK, so that the loop can be run on a host computer
+
+static int frame_lines;
+static int target_line;
+static int good_frames;
+// the difference in frame length, in 1/256 lines, found by summing the error
+static int rate;
+static struct genlock_stats state;
+
+static inline void clear_range() {
+    state.min_error = frame_lines;
+    state.max_error = -frame_lines;
+}
+
+void genlock_init(int total_lines, int setpoint) {
+    frame_lines = total_lines;
+    target_line = setpoint;
+    good_frames = 0;
+    rate = 0;
+    state = (struct genlock_stats){0};
+    clear_range();
+}
+
+static inline void unlock() {
+    if (state.locked) {
+        state.lock_losses++;
+    }
+    state.locked = false;
+    good_frames = 0;
+}
+
+int genlock_frame(int edge_line) {
+    state.frames++;
+    if (edge_line < 0) {
+        // no FS, run at the nominal timing until it comes back
+        state.missing++;
+        unlock();
+        state.adjust = 0;
+        return 0;
+    }
+
+    // the shorter way round to the setpoint
+    int error = edge_line - target_line;
+    if (error > frame_lines / 2) {
+        error -= frame_lines;
+    } else if (error <= -frame_lines / 2) {
+        error += frame_lines;
+    }
+    state.error = error;
+    if (error < state.min_error) {
+        state.min_error = error;
+    }
+    if (error > state.max_error) {
+        state.max_error = error;
+    }
+
+    if (error > GENLOCK_LOCK_LINES || error < -GENLOCK_LOCK_LINES) {
+        unlock();
+    } else if (!state.locked && ++good_frames >= GENLOCK_LOCK_FRAMES) {
+        state.locked = true;
+    }
+
+    // Lines added to the blanking are not counted, so the next edge is seen
+    // that many lines earlier. Half the error is taken out along with the
+    // difference in frame length, a sixteenth of the error summed over the
+    // frames, so that the error settles at zero rather than at the
+    // difference. This puts both poles of the loop at 0.75, slow enough not
+    // to follow the jitter in where the edge is seen.
+    int adjust = (error * 128 + rate + 128) >> 8;
+    if (adjust > GENLOCK_MAX_LINES) {
+        adjust = GENLOCK_MAX_LINES;
+    } else if (adjust < -GENLOCK_MAX_LINES) {
+        adjust = -GENLOCK_MAX_LINES;
+    } else {
+        // not while catching up, or the sum runs away
+        rate += error * 16;
+    }
+    state.adjust = adjust;
+    return adjust;
+}
+
+void genlock_get_stats(struct genlock_stats* stats) { *stats = state; }
+
+void genlock_print() {
+    const struct genlock_stats s = state;
+    clear_range();
+    printf("genlock %s, error %d (%d to %d), adjust %d\n",
+           s.locked ? "locked" : "unlocked", s.error, s.min_error,
+           s.max_error, s.adjust);
+    printf("%lu frames, %lu without FS, lock lost %lu times\n",
+           (unsigned long)s.frames, (unsigned long)s.missing,
+           (unsigned long)s.lock_losses);
+}
@@ -0,0 +1,100 @@
+/*
+
+Frame genlock to the Atom's field sync
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Build with GENLOCK=1 when PIN_VSYNC is driven by the Atom rather than by
+// the renderer. The scanout then follows the Atom's frames: once a frame the
+// line on which the falling edge of FS was seen is compared with the line
+// it should fall on, and the next vertical back porch is made longer or
+// shorter by whole lines to close the gap.
+//
+// genlock_frame() is a PI loop on that error, in lines. The proportional
+// term takes out half of the error each frame. The integral term adds a
+// sixteenth of the error to a sum kept in 1/256 lines, which so learns the
+// difference in frame length and brings the error to zero rather than
+// leaving it at that difference. Both poles of the loop are at 0.75, so it
+// locks in about 50 frames and does not follow the jitter in where the edge
+// is seen. The adjustment is clamped to GENLOCK_MAX_LINES and the sum is
+// not added to while it is, so catching up from a large error does not
+// wind it up.
+//
+// The two frame rates can differ by somewhat less than GENLOCK_MAX_LINES a
+// frame, some lines being needed to take out the error. The Atom's 59.9 Hz
+// against the 59.5 Hz of MODE_640x480_60_FAST is about 4 lines a frame.
+// Once locked the error stays within a line either way, from seeing the
+// edge on a whole line. render_util/genlock_sim runs the loop on a host.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Most lines added to or taken from one vertical blanking, small enough for
+// monitors to take as the same mode
+#ifndef GENLOCK_MAX_LINES
+#define GENLOCK_MAX_LINES 8
+#endif
+
+// Locked after this many frames in a row with an error of at most
+// GENLOCK_LOCK_LINES, unlocked by the first frame with more
+#define GENLOCK_LOCK_LINES 2
+#define GENLOCK_LOCK_FRAMES 16
+
+/// @brief the state of the genlock
+struct genlock_stats {
+    bool locked;          ///< following the Atom's frames
+    int error;            ///< the last error in lines, positive if the edge
+                          ///< came late
+    int min_error;        ///< smallest error since last printed
+    int max_error;        ///< largest error since last printed
+    int adjust;           ///< lines added to the last vertical blanking
+    uint32_t frames;      ///< frames since the start
+    uint32_t missing;     ///< frames without an edge
+    uint32_t lock_losses; ///< times the lock has been lost
+};
+
+/// @brief start again, unlocked
+/// @param total_lines lines in an output frame, blanking included
+/// @param setpoint the line the edge should be seen on
+void genlock_init(int total_lines, int setpoint);
+
+/// @brief work out the next frame's timing, called once a frame at the start
+/// of the vertical blanking
+/// @param edge_line the line the falling edge of FS was seen on during the
+/// frame just sent, -1 if there was none
+/// @return lines to add to the vertical blanking, negative to take away,
+/// at most GENLOCK_MAX_LINES either way
+int genlock_frame(int edge_line);
+
+/// @brief get the state of the genlock
+/// @param stats filled in with the current values
+void genlock_get_stats(struct genlock_stats* stats);
+
+/// @brief print the state to stdout and start the error range again
+void genlock_print();
+
+#ifdef __cplusplus
+}
+#endif
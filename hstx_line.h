@@ -0,0 +1,265 @@
+/*
+
+Display lines as lists of HSTX commands
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "videomode.h"
+
+#define HSTX_CMD_RAW (0x0u << 12)
+#define HSTX_CMD_RAW_REPEAT (0x1u << 12)
+#define HSTX_CMD_TMDS (0x2u << 12)
+#define HSTX_CMD_TMDS_REPEAT (0x3u << 12)
+#define HSTX_CMD_NOP (0xfu << 12)
+
+#define HSTX_CMD_MASK (0xfu << 12)
+#define HSTX_COUNT_MASK 0xfffu
+
+// DVI constants
+
+#define TMDS_CTRL_00 0x354u
+#define TMDS_CTRL_01 0x0abu
+#define TMDS_CTRL_10 0x154u
+#define TMDS_CTRL_11 0x2abu
+
+#define SYNC_V0_H0 (TMDS_CTRL_00 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
+#define SYNC_V0_H1 (TMDS_CTRL_01 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
+#define SYNC_V1_H0 (TMDS_CTRL_10 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
+#define SYNC_V1_H1 (TMDS_CTRL_11 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
+
+// Each active display line is sent to the HSTX as one list of commands, so
+// that it is one DMA transfer. Runs of one colour, such as the borders, are
+// a TMDS_REPEAT so only the pixels between them are drawn and read by the
+// DMA.
+//
+// A line buffer holds
+//   the horizontal blanking, line_hsync
+//   TMDS_REPEAT | left border, colour   (or two NOPs)
+//   TMDS | pixels, the pixels
+//   TMDS_REPEAT | right border, colour  (or two NOPs)
+#define LINE_HSYNC_WORDS 8
+#define LINE_HEADER_WORDS (LINE_HSYNC_WORDS + 3)
+#define LINE_TRAILER_WORDS 2
+#define LINE_BUFFER_WORDS                                       \
+    (LINE_HEADER_WORDS + MODE_H_MAX_PIXELS / PIXELS_PER_WORD + \
+     LINE_TRAILER_WORDS)
+
+// the horizontal blanking of the video mode in use, set up by
+// video_mode_select()
+extern uint32_t line_hsync[LINE_HSYNC_WORDS];
+
+// With PACKED_PIXELS a pixel is 4 bits, RGB121, two to a byte with the first
+// in the low nibble, and the HSTX takes 8 from each word. The colours are
+// approximate: each component keeps only its top bits, so red, blue and
+// orange are darker than in RGB332. The 6847 renderers write an Atom pixel
+// as one byte, as with NATIVE_SCANOUT.
+#if PACKED_PIXELS
+#if NATIVE_SCANOUT
+#error "PACKED_PIXELS cannot be used with NATIVE_SCANOUT"
+#endif
+#define PIXELS_PER_WORD 8
+#else
+#define PIXELS_PER_WORD 4
+#endif
+
+// bytes holding n pixels
+#define PIXEL_BYTES(n) ((n) * 4 / PIXELS_PER_WORD)
+
+// With NATIVE_SCANOUT the HSTX takes two pixels from each word and the
+// pixels of a line are sent as a DMA transfer of their own, after the
+// commands. The DMA replicates a narrow write across the whole word, so an
+// 8 bit transfer sends each pixel twice and a 16 bit transfer sends two
+// pixels once each. A line buffer then holds
+//   the horizontal blanking, LINE_HSYNC
+//   TMDS_REPEAT | left border, colour   (or two NOPs)
+//   TMDS | pixels and right border
+//   the pixels, followed by the right border as pixels
+// Its word count is the number of command words, LINE_HEADER_WORDS, with
+// LINE_DOUBLED set if the pixels are sent twice. The pixel transfer is half
+// as many bytes or halfwords as the TMDS count.
+#if NATIVE_SCANOUT
+#define LINE_DOUBLED 0x8000u
+#define LINE_WORDS_MASK 0x7fffu
+// Pixels sent by a line that is all one colour, so that its pixel transfer
+// is at least the HSTX FIFO size and the two DMA channels do not finish in
+// quick succession
+#define LINE_SOLID_PIXELS 16
+#endif
+
+/// @brief convert an RGB332 colour to the format of the line buffers
+/// @param c the colour
+/// @return the RGB121 colour with PACKED_PIXELS, otherwise c
+static inline pixel_t pack_colour(pixel_t c) {
+#if PACKED_PIXELS
+    return ((c >> 4) & 0x8) | ((c >> 2) & 0x6) | ((c >> 1) & 0x1);
+#else
+    return c;
+#endif
+}
+
+/// @brief convert a colour from a line buffer back to RGB332
+/// @param c the colour
+/// @return the RGB332 colour the HSTX sends for it
+static inline pixel_t unpack_colour(pixel_t c) {
+#if PACKED_PIXELS
+    return ((c & 0x8) << 4) | ((c & 0x6) << 2) | ((c & 0x1) << 1);
+#else
+    return c;
+#endif
+}
+
+/// @brief get a word of pixels all one colour
+/// @param colour the RGB332 colour
+/// @return the word
+static inline uint32_t pixel_word(pixel_t colour) {
+#if PACKED_PIXELS
+    return pack_colour(colour) * 0x11111111u;
+#else
+    return colour * 0x01010101u;
+#endif
+}
+
+// four pixels, as held in a line buffer
+#if PACKED_PIXELS
+typedef uint16_t pixel4_t;
+#else
+typedef uint32_t pixel4_t;
+#endif
+
+/// @brief get four pixels drawn from a nibble
+/// @param nibble the pixels, the first in bit 3
+/// @param fg the colour of set bits, as in the line buffers
+/// @param bg the colour of clear bits
+/// @return the pixels
+static inline pixel4_t nibble_pixels(int nibble, pixel_t fg, pixel_t bg) {
+    pixel4_t q = 0;
+    for (int i = 0; i < 4; i++) {
+        const pixel4_t c = (nibble & (8 >> i)) ? fg : bg;
+        q |= c << (i * pixel_bits);
+    }
+    return q;
+}
+
+/// @brief get where the pixels of a line are drawn
+/// @param line a line buffer of LINE_BUFFER_WORDS words
+/// @return the first pixel
+static inline pixel_t* line_pixels(uint32_t* line) {
+    return (pixel_t*)(line + LINE_HEADER_WORDS);
+}
+
+static inline uint32_t* line_add_hsync(uint32_t* q) {
+    for (int i = 0; i < LINE_HSYNC_WORDS; i++) {
+        *q++ = line_hsync[i];
+    }
+    return q;
+}
+
+static inline uint32_t* line_add_run(uint32_t* q, uint32_t count,
+                                     pixel_t colour) {
+    if (count) {
+        *q++ = HSTX_CMD_TMDS_REPEAT | count;
+        *q++ = pixel_word(colour);
+    } else {
+        *q++ = HSTX_CMD_NOP;
+        *q++ = HSTX_CMD_NOP;
+    }
+    return q;
+}
+
+#if NATIVE_SCANOUT
+
+static inline void line_fill(pixel_t* p, uint32_t count, pixel_t colour) {
+    for (uint32_t i = 0; i < count; i++) {
+        p[i] = colour;
+    }
+}
+
+/// @brief add the commands around pixels drawn at line_pixels()
+/// @param line the line buffer
+/// @param left width of the left border, a multiple of 4
+/// @param width number of pixels drawn, a multiple of 4
+/// @param colour colour of both borders
+/// @return number of command words
+static inline uint32_t line_finish(uint32_t* line, uint32_t left,
+                                   uint32_t width, pixel_t colour) {
+    uint32_t* q = line_add_run(line_add_hsync(line), left, colour);
+    *q = HSTX_CMD_TMDS | (MODE_H_ACTIVE_PIXELS - left);
+    line_fill(line_pixels(line) + width, MODE_H_ACTIVE_PIXELS - left - width,
+              colour);
+    return LINE_HEADER_WORDS;
+}
+
+/// @brief add the commands around pixels drawn at line_pixels() at half
+/// width, to be sent twice each
+/// @param line the line buffer
+/// @param left width of the left border, a multiple of 4
+/// @param width width of the pixels once doubled, a multiple of 4
+/// @param colour colour of both borders
+/// @return number of command words and LINE_DOUBLED
+static inline uint32_t line_finish_doubled(uint32_t* line, uint32_t left,
+                                           uint32_t width, pixel_t colour) {
+    uint32_t* q = line_add_run(line_add_hsync(line), left, colour);
+    *q = HSTX_CMD_TMDS | (MODE_H_ACTIVE_PIXELS - left);
+    line_fill(line_pixels(line) + width / 2,
+              (MODE_H_ACTIVE_PIXELS - left - width) / 2, colour);
+    return LINE_HEADER_WORDS | LINE_DOUBLED;
+}
+
+/// @brief make a line that is all one colour
+/// @param line the line buffer
+/// @param colour the colour
+/// @return number of command words and LINE_DOUBLED
+static inline uint32_t line_solid(uint32_t* line, pixel_t colour) {
+    return line_finish_doubled(line, MODE_H_ACTIVE_PIXELS - LINE_SOLID_PIXELS,
+                               0, colour);
+}
+
+#else
+
+/// @brief add the commands around pixels drawn at line_pixels()
+/// @param line the line buffer
+/// @param left width of the left border, a multiple of PIXELS_PER_WORD
+/// @param width number of pixels drawn, a multiple of PIXELS_PER_WORD
+/// @param colour colour of both borders
+/// @return number of words in the list
+static inline uint32_t line_finish(uint32_t* line, uint32_t left,
+                                   uint32_t width, pixel_t colour) {
+    uint32_t* q = line_add_run(line_add_hsync(line), left, colour);
+    *q = HSTX_CMD_TMDS | width;
+    const uint32_t* end =
+        line_add_run(line + LINE_HEADER_WORDS + width / PIXELS_PER_WORD,
+                     MODE_H_ACTIVE_PIXELS - left - width, colour);
+    return end - line;
+}
+
+/// @brief make a line that is all one colour
+/// @param line the line buffer
+/// @param colour the colour
+/// @return number of words in the list
+static inline uint32_t line_solid(uint32_t* line, pixel_t colour) {
+    const uint32_t* end =
+        line_add_run(line_add_hsync(line), MODE_H_ACTIVE_PIXELS, colour);
+    return end - line;
+}
+
+#endif
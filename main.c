@@ -35,6 +35,8 @@ Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
 #include "time.h"
 #include "ui.h"
 #include "capture.h"
+#include "settings.h"
+#include "trace.h"
 
 void hstx_main(void);
 #define DMACH_PING 0
@@ -45,6 +47,9 @@ void hstx_main(void);
 
 static semaphore_t core1_initted;
 
+// the video mode and renderer, chosen at boot
+static struct settings settings;
+
 /// @brief emit diagnostic tones from the pwm-audio pin
 /// @param args list of frquencies to emit termiated with -1
 void beep(int args, ...) {
@@ -157,8 +162,8 @@ void benchmark_draw_line();
 /// @brief
 void core1_func() {
     // run sid on this core
-    mc6847_init(VDU_RAM, RESET==0);
-    teletext_init();
+    mc6847_init(VDU_RAM, RESET==0, settings.teletext);
+    trace_init(settings.mode, settings.teletext);
     //benchmark_draw_line();
     as_init();
     ui_init();
@@ -190,9 +195,64 @@ void core1_func() {
     }
 }
 
+// PIN_NRST is also low while the Atom's own power on reset holds it, so
+// BREAK is only taken once that has ended, and only while the capture button,
+// which power on cannot press, is held
+#define RESET_RELEASE_MS 2000  // the longest the Atom's reset is waited for
+#define BREAK_HOLD_MS 1000     // BREAK held down continuously this long
+#define RELEASE_MS 20          // the capture button is let go for this long
+
+/// @brief watch BREAK while the capture button is held at power on
+/// @return true if BREAK was held down for BREAK_HOLD_MS, false if the
+/// capture button was let go first or the Atom's reset did not end
+static bool break_held() {
+    for (int ms = 0; !gpio_get(PIN_NRST); ms++) {
+        if (ms == RESET_RELEASE_MS) {
+            return false;
+        }
+        busy_wait_ms(1);
+    }
+    int break_ms = 0;
+    int released_ms = 0;
+    while (released_ms < RELEASE_MS) {
+        busy_wait_ms(1);
+        released_ms = gpio_get(PIN_CAPTURE_BUTTON) ? released_ms + 1 : 0;
+        break_ms = gpio_get(PIN_NRST) ? 0 : break_ms + 1;
+        if (break_ms == BREAK_HOLD_MS) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief choose the video mode and renderer from the saved settings and the
+/// buttons held at power on, see settings.h
+static void choose_settings() {
+    settings_load(&settings);
+
+    gpio_init(PIN_CAPTURE_BUTTON);
+    gpio_set_dir(PIN_CAPTURE_BUTTON, false);
+    gpio_pull_up(PIN_CAPTURE_BUTTON);
+    gpio_init(PIN_NRST);
+    gpio_set_dir(PIN_NRST, false);
+    busy_wait_us(100);
+
+    if (!gpio_get(PIN_CAPTURE_BUTTON)) {
+        if (break_held()) {
+            settings.teletext = !settings.teletext;
+        } else {
+            settings.mode = video_mode_next(settings.mode);
+        }
+        settings_save(&settings);
+    }
+    video_mode_select(settings.mode);
+}
+
 int main(void) {
     //beep(250, 500, -1);
 
+    choose_settings();
+
     // Set custom clock speeds
     if (SYS_CLK_KHZ != REQUIRED_SYS_CLK_KHZ) {
         set_sys_clock_khz(REQUIRED_SYS_CLK_KHZ, true);
@@ -208,6 +268,7 @@ int main(void) {
     stdio_init_all();
 
     printf("Atom DVI v1.0.0\n");
+    printf("%s, %s\n", video_mode.name, settings.teletext ? "teletext" : "6847");
     measure_freqs();
 
     // initialise the shadow memory
@@ -218,9 +279,13 @@ int main(void) {
     // Reserve DMA channels for hstx use
     dma_claim_mask((1u << DMACH_PING) | (1u << DMACH_PONG));
 
-    // Initialise VSYNC GPIO
+    // Initialise VSYNC GPIO, an input from the Atom with GENLOCK
     gpio_init(PIN_VSYNC);
+#if GENLOCK
+    gpio_set_dir(PIN_VSYNC, false);
+#else
     gpio_set_dir(PIN_VSYNC, true);
+#endif
     gpio_init(PIN_NRST);
 
     // Initialise capture button GPIO
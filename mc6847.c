@@ -22,23 +22,82 @@ Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
 
 #include "mc6847.h"
 
+#include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "atom_if.h"
 #include "atom_sid.h"
 #include "colours.h"
+#include "eb_handlers.h"
 #include "fonts.h"
+#include "hstx_line.h"
 #include "hardware/sync.h"
 #include "pico/time.h"
 #include "pico/util/queue.h"
 #include "platform.h"
+#include "render_stats.h"
 #include "teletext.h"
 #include "videomode.h"
 
-// defines the number of buffers in the line buffer pool
+// defines the number of lines in flight, that is the line being scanned out
+// and the lines rendered ahead of it. Can be set at build time to trade
+// latency for headroom when some lines are slow to render.
+#ifndef LINE_BUFFER_POOL_COUNT
 #define LINE_BUFFER_POOL_COUNT 2
-pixel_t line_buffer_pool[LINE_BUFFER_POOL_COUNT][MODE_H_ACTIVE_PIXELS];
+#endif
+static_assert((LINE_BUFFER_POOL_COUNT & (LINE_BUFFER_POOL_COUNT - 1)) == 0,
+              "LINE_BUFFER_POOL_COUNT must be a power of 2");
+
+// One more buffer than lines in flight, so that a late line can be replaced
+// by the previous line while the renderer carries on
+#define LINE_BUFFER_COUNT (LINE_BUFFER_POOL_COUNT + 1)
+static uint32_t line_buffer_pool[LINE_BUFFER_COUNT][LINE_BUFFER_WORDS];
+
+// the number of HSTX command words in each buffer
+static uint16_t line_buffer_words[LINE_BUFFER_COUNT];
+
+// Lines are identified by a sequence number that keeps counting across
+// frames, frame * MODE_V_ACTIVE_LINES + line_num, so that a buffer left over
+// from the previous frame is never mistaken for a new one.
+//
+// For each of the lines in flight, indexed by seq % LINE_BUFFER_POOL_COUNT:
+// line_planned is the line's sequence number, written once the line has been
+// given a buffer, line_buffer_index is that buffer and line_source is the
+// line that will be painted into it. A line that repeats the previous line
+// shares its buffer and source. The line is ready when buffer_painted for its
+// buffer matches its source.
+static volatile uint32_t line_planned[LINE_BUFFER_POOL_COUNT];
+static volatile uint8_t line_buffer_index[LINE_BUFFER_POOL_COUNT];
+static volatile uint32_t line_source[LINE_BUFFER_POOL_COUNT];
+static volatile uint32_t buffer_painted[LINE_BUFFER_COUNT];
+
+// the line being scanned out and its buffer, and the buffer before it, which
+// the DMA may still be reading when the next line is requested
+static volatile uint32_t scanout_seq = -1;
+static uint32_t* volatile scanout_buf = NULL;
+static uint32_t* volatile scanout_prev = NULL;
+static uint32_t scanout_words;
+
+// the last line planned
+static volatile uint32_t planned_seq = -1;
+
+// shown in place of a late line when there is no previous line to repeat,
+// made by mc6847_init() for the video mode
+static uint32_t blank_line[LINE_BUFFER_WORDS];
+static uint32_t blank_line_words;
+
+static struct mc6847_line_stats line_stats;
+static int frame_min_slack = LINE_BUFFER_POOL_COUNT;
+static int frame_max_slack = -MODE_V_MAX_LINES;
+
+// the sequence number of the frame's first line, less a frame until the
+// first frame starts
+static uint32_t frame_seq;
+
+// teletext is drawn in place of the 6847, chosen at boot
+static bool teletext_renderer;
 
 static queue_t line_request_queue;
 
@@ -165,16 +224,18 @@ unsigned int bytes_per_row(unsigned int mode) {
     return retval;
 };
 
-const unsigned int lines_per_row_lookup[] = {6, 6, 6, 4, 4, 2, 2, 2};
+// 6847 lines for each row of bytes
+const unsigned int lines_per_row_lookup[] = {3, 3, 3, 2, 2, 1, 1, 1};
 
+// output lines for each row of bytes
 unsigned int lines_per_row(unsigned int mode) {
     unsigned int retval;
     if (!(mode & 1)) {
-        retval = 24;
+        retval = 12;
     } else {
         retval = lines_per_row_lookup[mode / 2];
     }
-    return retval;
+    return retval * YSCALE;
 }
 
 #define COL80_OFF 0x00
@@ -184,10 +245,24 @@ unsigned int lines_per_row(unsigned int mode) {
 const uint chars_per_row = 32;
 
 const uint max_width = 256 * XSCALE;
+
+// Each Atom pixel is written PIXEL_REPEAT times, only once when the HSTX
+// doubles the pixels as they are scanned out or when one byte holds both
+// packed pixels
+#if NATIVE_SCANOUT
+static_assert(XSCALE == 2, "NATIVE_SCANOUT only doubles pixels");
+#define PIXEL_REPEAT 1
+#elif PACKED_PIXELS
+static_assert(XSCALE == 2, "PACKED_PIXELS only doubles pixels");
+#define PIXEL_REPEAT 1
+#else
+#define PIXEL_REPEAT XSCALE
+#endif
 const uint max_height = 192 * YSCALE;
 
-const uint vertical_offset = (MODE_V_ACTIVE_LINES - max_height) / 2;
-const uint horizontal_offset = (MODE_H_ACTIVE_PIXELS - max_width) / 2;
+// where the 6847 picture goes in the video mode, set by mc6847_init()
+static uint vertical_offset;
+static uint horizontal_offset;
 
 void reset_vga80() {
     eb_set(COL80_BASE, COL80_OFF);
@@ -196,38 +271,29 @@ void reset_vga80() {
     eb_set(COL80_STAT, 0x12);
 }
 
-static pixel2_t vga80_lut[128 * 4];
+// The glyph rows pre-expanded for each pair of colours, so that a character
+// cell is two loads and two stores. Indexed by the attribute byte's colours
+// and a nibble of the glyph row, its first pixel in bit 3.
+//
+// Bit  6  5  4  3  2  1  0
+//      --bgc--  x  --fgc--
+//
+static pixel4_t vga80_lut[128][16];
 
 void initialize_vga80() {
     // Reset the VGA80 hardware
     reset_vga80();
-    // Use an LUT to allow two pixels to be calculated at once, taking account
-    // of the attribute byte for colours
-    //
-    // Bit  8  7  6  5  4  3  2  1   0
-    //      --bgc--  x  --fgc--  p1 p0
-    //
-    for (int i = 0; i < 128 * 4; i++) {
-        vga80_lut[i] = ((i & 1) ? colour_palette_vga80[(i >> 2) & 7]
-                                : colour_palette_vga80[(i >> 6) & 7])
-                       << 8;
-        vga80_lut[i] |= ((i & 2) ? colour_palette_vga80[(i >> 2) & 7]
-                                 : colour_palette_vga80[(i >> 6) & 7]);
+    for (int attr = 0; attr < 128; attr++) {
+        const pixel_t fg = pack_colour(colour_palette_vga80[attr & 7]);
+        const pixel_t bg = pack_colour(colour_palette_vga80[(attr >> 4) & 7]);
+        for (int n = 0; n < 16; n++) {
+            vga80_lut[attr][n] = nibble_pixels(n, fg, bg);
+        }
     }
 }
 
 static inline int _calc_fb_base() { return FB_ADDR; }
 
-static inline uint8_t* add_border(uint8_t* buffer, const uint8_t color,
-                                  const int width) {
-    const uint x = color | (color << 8) | (color << 16) | (color << 24);
-    uint* b = (uint*)buffer;
-    for (int i = 0; i < width / 4; i++) {
-        *b++ = x;
-    }
-    return (uint8_t*)b;
-}
-
 volatile uint8_t artifact = 0;
 
 static inline bool alt_colour() {
@@ -246,20 +312,36 @@ int get_mode() {
 #endif
 }
 
+#if NATIVE_SCANOUT || PACKED_PIXELS
+// an Atom pixel is one byte, with PACKED_PIXELS the colour twice
 static inline void write_pixel(pixel_t** pp, pixel_t c) {
-    uint16_t* q = (uint16_t*)*pp;
-    q[0] = (c << 8) + c;
-    *pp += 2;
+#if PACKED_PIXELS
+    **pp = pack_colour(c) * 0x11;
+#else
+    **pp = c;
+#endif
+    *pp += 1;
 }
 
 static inline void write_pixel2(pixel_t** pp, pixel_t c) {
-    uint32_t* q = (uint32_t*)*pp;
-    uint32_t x = (c << 8) + c;
-    x = (x << 16) + x;
-    q[0] = x;
-    *pp += 4;
+    write_pixel(pp, c);
+    write_pixel(pp, c);
+}
+#else
+// an Atom pixel is XSCALE bytes
+static inline void write_pixel(pixel_t** pp, pixel_t c) {
+    for (int i = 0; i < XSCALE; i++) {
+        (*pp)[i] = c;
+    }
+    *pp += XSCALE;
 }
 
+static inline void write_pixel2(pixel_t** pp, pixel_t c) {
+    write_pixel(pp, c);
+    write_pixel(pp, c);
+}
+#endif
+
 static inline void write_pixel4(pixel_t** pp, pixel_t c) {
     write_pixel2(pp, c);
     write_pixel2(pp, c);
@@ -270,99 +352,79 @@ static inline void write_pixel8(pixel_t** pp, pixel_t c) {
     write_pixel4(pp, c);
 }
 
-static inline pixel_t* do_graphics(pixel_t* p, int mode, int atom_fb,
-                                   int border_colour, int _relative_line_num) {
-    size_t bp = atom_fb;
-
-    const uint pixel_count = get_width(mode);
-
-    pixel_t* palette = colour_palette;
-    if (alt_colour()) {
-        palette += 4;
+// Lookup tables that convert a byte of video memory to LUT_WORDS words of
+// pixels, 8 * PIXEL_REPEAT bytes. They are rebuilt when the colours they
+// were built for change, in place, so first every line planned with them is
+// painted, see finish_jobs().
+#define LUT_WORDS (2 * PIXEL_REPEAT)
+typedef uint32_t graphics_lut_t[256][LUT_WORDS];
+
+static graphics_lut_t mono_lut;      // 8 pixels, each output PIXEL_REPEAT times
+static graphics_lut_t artifact_lut;  // 4 artifacted pixel pairs
+static graphics_lut_t colour_lut;    // 4 pixels, each output twice as often
+
+static void finish_jobs();
+
+// Spread the bits of a nibble so that each bit appears twice
+static const uint8_t double_bits[16] = {0x00, 0x03, 0x0C, 0x0F, 0x30, 0x33,
+                                        0x3C, 0x3F, 0xC0, 0xC3, 0xCC, 0xCF,
+                                        0xF0, 0xF3, 0xFC, 0xFF};
+
+// Spread the bits of a pair so that each bit appears four times
+static const uint8_t quad_bits[4] = {0x00, 0x0F, 0xF0, 0xFF};
+
+static const uint32_t* get_mono_lut(pixel_t fg) {
+    static bool valid = false;
+    static pixel_t lut_fg;
+    if (!valid || fg != lut_fg) {
+        finish_jobs();
+        for (int i = 0; i < 256; i++) {
+            pixel_t* p = (pixel_t*)mono_lut[i];
+            for (int mask = 0x80; mask > 0; mask = mask >> 1) {
+                write_pixel(&p, (i & mask) ? fg : 0);
+            }
+        }
+        lut_fg = fg;
+        valid = true;
     }
-    pixel_t* art_palette =
-        (1 == artifact) ? colour_palette_artifact1 : colour_palette_artifact2;
+    return mono_lut[0];
+}
 
-    if (is_colour(mode)) {
-        uint32_t word = 0;
-        for (uint pixel = 0; pixel < pixel_count; pixel++) {
-            if ((pixel % 16) == 0) {
-                word = eb_get32(bp);
-                bp += 4;
+static const uint32_t* get_artifact_lut(const pixel_t* art_palette) {
+    static const pixel_t* lut_palette = NULL;
+    if (art_palette != lut_palette) {
+        finish_jobs();
+        for (int i = 0; i < 256; i++) {
+            pixel_t* p = (pixel_t*)artifact_lut[i];
+            for (int shift = 6; shift >= 0; shift -= 2) {
+                write_pixel2(&p, art_palette[(i >> shift) & 0b11]);
             }
-            uint x = (word >> 30) & 0b11;
-            uint16_t colour = palette[x];
-            if (pixel_count == 128) {
-                write_pixel2(&p, colour);
-            } else if (pixel_count == 64) {
-                write_pixel4(&p, colour);
-            }
-            word = word << 2;
         }
-    } else {
-        uint16_t fg = palette[0];
-        for (uint i = 0; i < pixel_count / 32; i++) {
-            const uint32_t b = eb_get32(bp);
-            bp += 4;
-            if (pixel_count == 256) {
-                if (0 == artifact) {
-                    write_pixel(&p, (b & 0x1 << 31) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 30) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 29) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 28) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 27) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 26) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 25) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 24) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 23) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 22) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 21) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 20) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 19) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 18) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 17) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 16) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 15) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 14) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 13) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 12) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 11) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 10) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 9) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 8) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 7) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 6) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 5) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 4) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 3) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 2) ? fg : 0);
-                    write_pixel(&p, (b & 0x1 << 1) ? fg : 0);
-                    write_pixel(&p, (b & 0x1) ? fg : 0);
-                } else {
-                    uint32_t word = b;
-                    for (uint apixel = 0; apixel < 16; apixel++) {
-                        uint acol = (word >> 30) & 0b11;
-                        uint16_t colour = art_palette[acol];
-
-                        write_pixel2(&p, colour);
+        lut_palette = art_palette;
+    }
+    return artifact_lut[0];
+}
 
-                        word = word << 2;
-                    }
-                }
-            } else if (pixel_count == 128) {
-                for (uint32_t mask = 0x80000000; mask > 0; mask = mask >> 1) {
-                    uint16_t colour = (b & mask) ? palette[0] : 0;
-                    write_pixel2(&p, colour);
-                }
-            } else if (pixel_count == 64) {
-                for (uint32_t mask = 0x80000000; mask > 0; mask = mask >> 1) {
-                    uint16_t colour = (b & mask) ? palette[0] : 0;
-                    write_pixel4(&p, colour);
-                }
+static const uint32_t* get_colour_lut(const pixel_t* palette) {
+    static const pixel_t* lut_palette = NULL;
+    if (palette != lut_palette) {
+        finish_jobs();
+        for (int i = 0; i < 256; i++) {
+            pixel_t* p = (pixel_t*)colour_lut[i];
+            for (int shift = 6; shift >= 0; shift -= 2) {
+                write_pixel2(&p, palette[(i >> shift) & 0b11]);
             }
         }
+        lut_palette = palette;
     }
-    return p;
+    return colour_lut[0];
+}
+
+static inline uint32_t* copy_lut_entry(uint32_t* q, const uint32_t* e) {
+    for (int i = 0; i < LUT_WORDS; i++) {
+        q[i] = e[i];
+    }
+    return q + LUT_WORDS;
 }
 
 #define INV_MASK 0x80
@@ -382,8 +444,10 @@ volatile uint8_t max_lower = LOWER_END;
 #define GetSAMSG() 0
 
 static inline void do_char(pixel_t* p, uint sub_row, char ch) {
-    const pixel2_t fg_colour = AT_ORANGE | AT_ORANGE << pixel_bits;
-    const pixel2_t bg_colour = AT_WHITE_1 | AT_WHITE_1 << pixel_bits;
+    const pixel2_t fg_colour =
+        pack_colour(AT_ORANGE) | pack_colour(AT_ORANGE) << pixel_bits;
+    const pixel2_t bg_colour =
+        pack_colour(AT_WHITE_1) | pack_colour(AT_WHITE_1) << pixel_bits;
 
     pixel2_t* q = (pixel2_t*)p;
 
@@ -416,97 +480,291 @@ static inline void do_string(pixel_t* p, uint sub_row, char* str) {
     }
 }
 
-pixel_t* do_text(int mode, int atom_fb, int border_colour,
-                 unsigned int relative_line_num, pixel_t* p) {
-    // Screen is 16 rows x 32 columns
-    // Each char is 12 x 8 pixels
-    const uint row = (relative_line_num) / 12;  // char row
-    const uint sub_row =
-        (relative_line_num) % 12;  // scanline within current char row
-    uint sgidx = GetSAMSG();       // index into semigraphics table
-    const uint rows_per_char =
-        12 / sg_bytes_row[sgidx];  // bytes per character space vertically
-    const uint8_t* fontdata =
-        fonts[fontno].fontdata + sub_row;  // Local fontdata pointer
+// Glyph cache for the text and semigraphics modes. Every character code and
+// scanline maps to a cell of LUT_WORDS words of pixels, so a character is
+// drawn by copying a few words. The index depends only on the font and the lower case
+// settings, the cells only on the colours, so each is rebuilt separately.
+//
+// Cells 0 - 255 are text, indexed by font byte
+// Cells 256 - 511 are inverse text
+// Cells 512 - 543 are SG4, colour * 4 + pattern
+// Cells 544 - 559 are SG6, colour * 4 + pattern
+#define GLYPH_TEXT 0
+#define GLYPH_INVERSE 256
+#define GLYPH_SG4 512
+#define GLYPH_SG6 544
+#define GLYPH_CELLS 560
+
+static uint16_t glyph_index[12][256];
+// normal and alt colour sets
+static uint32_t glyph_cells[2][GLYPH_CELLS][LUT_WORDS];
+
+static const uint16_t (*get_glyph_index())[256] {
+    static bool valid = false;
+    static uint8_t index_fontno;
+    static bool index_support_lower;
+    static uint8_t index_max_lower;
+    if (!valid || fontno != index_fontno ||
+        support_lower != index_support_lower ||
+        max_lower != index_max_lower) {
+        finish_jobs();
+        index_fontno = fontno;
+        index_support_lower = support_lower;
+        index_max_lower = max_lower;
+        valid = true;
+        for (uint sub_row = 0; sub_row < 12; sub_row++) {
+            const uint8_t* fontdata = fonts[index_fontno].fontdata + sub_row;
+            for (uint ch = 0; ch < 256; ch++) {
+                uint16_t cell;
+                if (!(ch & AS_MASK)) {
+                    bool inverse = ch & INV_MASK;
+                    uint8_t b = fontdata[(ch & 0x3f) * 12];
+                    if (index_support_lower && ch >= LOWER_START &&
+                        ch <= index_max_lower) {
+                        b = fontdata[((ch & 0x3f) + 64) * 12];
+                        inverse = LOWER_INVERT;
+                    }
+                    cell = (inverse ? GLYPH_INVERSE : GLYPH_TEXT) + b;
+                } else if (GetIntExt(ch)) {
+                    uint pix_row = 2 - (sub_row / 4);
+                    cell = GLYPH_SG6 +
+                           ((ch & SG6_COL_MASK) >> SG6_COL_SHIFT) * 4 +
+                           ((ch >> (pix_row * 2)) & 0b11);
+                } else {
+                    uint pix_row = 1 - (sub_row / 6);
+                    cell = GLYPH_SG4 +
+                           ((ch & SG4_COL_MASK) >> SG4_COL_SHIFT) * 4 +
+                           ((ch >> (pix_row * 2)) & 0b11);
+                }
+                glyph_index[sub_row][ch] = cell;
+            }
+        }
+    }
+    return (const uint16_t(*)[256])glyph_index;
+}
 
-    if (row < 16) {
-        for (int col = 0; col < 32; col++) {
-            // Get character data from RAM and extract inv,ag,int/ext
-            uint ch = eb_get(atom_fb + col);
-            bool inv = (ch & INV_MASK) ? true : false;
-            bool as = (ch & AS_MASK) ? true : false;
-            bool intext = GetIntExt(ch);
+static inline void build_block_cell(uint32_t* cell, pixel_t fg, pixel_t bg,
+                                    uint pattern) {
+    pixel_t* p = (pixel_t*)cell;
+    write_pixel4(&p, (pattern & 0b10) ? fg : bg);
+    write_pixel4(&p, (pattern & 0b01) ? fg : bg);
+}
 
-            uint16_t fg_colour;
-            uint16_t bg_colour = paper;
+static const uint32_t (*get_glyph_cells(bool alt))[LUT_WORDS] {
+    static bool valid[2] = {false, false};
+    static pixel_t cells_ink[2];
+    static pixel_t cells_paper[2];
+    const pixel_t fg = alt ? ink_alt : ink;
+    const pixel_t bg = paper;
+    if (!valid[alt] || fg != cells_ink[alt] || bg != cells_paper[alt]) {
+        finish_jobs();
+        uint32_t(*cells)[LUT_WORDS] = glyph_cells[alt];
+        for (int i = 0; i < 256; i++) {
+            pixel_t* p = (pixel_t*)cells[GLYPH_TEXT + i];
+            pixel_t* q = (pixel_t*)cells[GLYPH_INVERSE + i];
+            for (int mask = 0x80; mask > 0; mask = mask >> 1) {
+                write_pixel(&p, (i & mask) ? fg : bg);
+                write_pixel(&q, (i & mask) ? bg : fg);
+            }
+        }
+        for (int i = 0; i < 8 * 4; i++) {
+            build_block_cell(cells[GLYPH_SG4 + i], colour_palette_atom[i / 4],
+                             bg, i & 3);
+        }
+        const pixel_t* sg6_palette = colour_palette_atom + (alt ? 4 : 0);
+        for (int i = 0; i < 4 * 4; i++) {
+            build_block_cell(cells[GLYPH_SG6 + i], sg6_palette[i / 4], bg,
+                             i & 3);
+        }
+        cells_ink[alt] = fg;
+        cells_paper[alt] = bg;
+        valid[alt] = true;
+    }
+    return (const uint32_t(*)[LUT_WORDS])glyph_cells[alt];
+}
 
-            // Deal with text mode first as we can decide this purely on the
-            // setting of the alpha/semi bit.
-            if (!as) {
-                uint8_t b = fontdata[(ch & 0x3f) * 12];
+/// Values the line renderers need that do not change during a line. They are
+/// set up at the start of each frame and whenever a mode register is written.
+struct frame_ctx {
+    const uint32_t (*colour_lut)[LUT_WORDS];
+    const uint32_t (*mono_lut)[LUT_WORDS];
+    const uint32_t (*mono256_lut)[LUT_WORDS];  // mono or artifacted
+    const uint16_t (*glyph_index)[256];
+    const uint32_t (*glyph_cells)[LUT_WORDS];  // for the selected colour set
+    bool alt;
+};
 
-                fg_colour = alt_colour() ? ink_alt : ink;
+static struct frame_ctx frame_ctx;
 
-                if (support_lower && ch >= LOWER_START && ch <= max_lower) {
-                    b = fontdata[((ch & 0x3f) + 64) * 12];
+static inline void setup_frame_ctx() {
+    struct frame_ctx* ctx = &frame_ctx;
+    ctx->alt = alt_colour();
 
-                    if (LOWER_INVERT) {
-                        bg_colour = fg_colour;
-                        fg_colour = paper;
-                    }
-                } else if (inv) {
-                    bg_colour = fg_colour;
-                    fg_colour = paper;
-                }
+    pixel_t* palette = colour_palette;
+    if (ctx->alt) {
+        palette += 4;
+    }
+    ctx->colour_lut = (const uint32_t(*)[LUT_WORDS])get_colour_lut(palette);
+    ctx->mono_lut = (const uint32_t(*)[LUT_WORDS])get_mono_lut(palette[0]);
+    ctx->mono256_lut = ctx->mono_lut;
+    if (artifact) {
+        ctx->mono256_lut = (const uint32_t(*)[LUT_WORDS])get_artifact_lut(
+            (1 == artifact) ? colour_palette_artifact1
+                            : colour_palette_artifact2);
+    }
 
-                if (b == 0) {
-                    write_pixel8(&p, bg_colour);
-                } else {
-                    // The internal character generator is only 6 bits wide,
-                    // however external character ROMS are 8 bits wide so we
-                    // must handle them here
-                    write_pixel(&p, (b & 0x80) ? fg_colour : bg_colour);
-                    write_pixel(&p, (b & 0x40) ? fg_colour : bg_colour);
-                    write_pixel(&p, (b & 0x20) ? fg_colour : bg_colour);
-                    write_pixel(&p, (b & 0x10) ? fg_colour : bg_colour);
-                    write_pixel(&p, (b & 0x08) ? fg_colour : bg_colour);
-                    write_pixel(&p, (b & 0x04) ? fg_colour : bg_colour);
-                    write_pixel(&p, (b & 0x02) ? fg_colour : bg_colour);
-                    write_pixel(&p, (b & 0x01) ? fg_colour : bg_colour);
-                }
-            } else  // Semigraphics
-            {
-                uint colour_index;
+    ctx->glyph_index = get_glyph_index();
+    ctx->glyph_cells = get_glyph_cells(ctx->alt);
+}
 
-                if (as && intext) {
-                    sgidx = SG6_INDEX;  // SG6
+/// @brief draw the active part of a 6847 line
+/// @param ctx the per-frame values
+/// @param bytes the line's bytes of video memory, read once by plan_line() so
+/// that the line drawn is the one the line cache keeps them with
+/// @param line the native line number, 0 - 191
+/// @param p output buffer
+/// @return pointer to the pixel after the last one written
+typedef pixel_t* (*line_renderer_t)(const struct frame_ctx* ctx,
+                                    const uint8_t* bytes, uint line,
+                                    pixel_t* p);
+
+/// @brief template for the graphics renderers, pixel_count and colour are
+/// constants in each instance so only one of the loops is compiled in
+static inline __attribute__((always_inline)) pixel_t* graphics_template(
+    const struct frame_ctx* ctx, const uint8_t* bytes, pixel_t* p,
+    const uint pixel_count, const bool colour) {
+    const uint8_t* bp = bytes;
+
+    uint32_t* q = (uint32_t*)p;
+    if (colour) {
+        const uint32_t(*lut)[LUT_WORDS] = ctx->colour_lut;
+        if (pixel_count == 128) {
+            for (uint i = 0; i < 128 / 4; i++) {
+                q = copy_lut_entry(q, lut[*bp++]);
+            }
+        } else if (pixel_count == 64) {
+#if NATIVE_SCANOUT || PACKED_PIXELS
+            // each pixel is a halfword in the table, so output each halfword
+            // twice
+            for (uint i = 0; i < 64 / 4; i++) {
+                const uint16_t* e = (const uint16_t*)lut[*bp++];
+                q[0] = e[0] * 0x10001u;
+                q[1] = e[1] * 0x10001u;
+                q[2] = e[2] * 0x10001u;
+                q[3] = e[3] * 0x10001u;
+                q += 4;
+            }
+#elif (XSCALE == 2)
+            // each pixel is a whole word in the table, so output each word
+            // twice
+            for (uint i = 0; i < 64 / 4; i++) {
+                const uint32_t* e = lut[*bp++];
+                q[0] = e[0];
+                q[1] = e[0];
+                q[2] = e[1];
+                q[3] = e[1];
+                q[4] = e[2];
+                q[5] = e[2];
+                q[6] = e[3];
+                q[7] = e[3];
+                q += 8;
+            }
+#else
+            // each pixel is 2 * XSCALE bytes in the table, output as XSCALE
+            // words
+            for (uint i = 0; i < 64 / 4; i++) {
+                const pixel_t* e = (const pixel_t*)lut[*bp++];
+                for (int k = 0; k < 4; k++) {
+                    const uint32_t x = e[k * 2 * XSCALE] * 0x01010101u;
+                    for (int j = 0; j < XSCALE; j++) {
+                        *q++ = x;
+                    }
                 }
+            }
+#endif
+        }
+    } else {
+        const uint32_t(*lut)[LUT_WORDS] = ctx->mono_lut;
+        if (pixel_count == 256) {
+            lut = ctx->mono256_lut;
+            for (uint i = 0; i < 256 / 8; i++) {
+                q = copy_lut_entry(q, lut[*bp++]);
+            }
+        } else if (pixel_count == 128) {
+            for (uint i = 0; i < 128 / 8; i++) {
+                uint8_t b = *bp++;
+                q = copy_lut_entry(q, lut[double_bits[b >> 4]]);
+                q = copy_lut_entry(q, lut[double_bits[b & 0xF]]);
+            }
+        } else if (pixel_count == 64) {
+            for (uint i = 0; i < 64 / 8; i++) {
+                uint8_t b = *bp++;
+                q = copy_lut_entry(q, lut[quad_bits[b >> 6]]);
+                q = copy_lut_entry(q, lut[quad_bits[(b >> 4) & 3]]);
+                q = copy_lut_entry(q, lut[quad_bits[(b >> 2) & 3]]);
+                q = copy_lut_entry(q, lut[quad_bits[b & 3]]);
+            }
+        }
+    }
+    return (pixel_t*)q;
+}
 
-                colour_index = (SG6_INDEX == sgidx)
-                                   ? (ch & SG6_COL_MASK) >> SG6_COL_SHIFT
-                                   : (ch & SG4_COL_MASK) >> SG4_COL_SHIFT;
-
-                if (alt_colour() && (SG6_INDEX == sgidx)) {
-                    colour_index += 4;
-                }
+/// @brief template for the text and semigraphics renderer
+static inline __attribute__((always_inline)) pixel_t* text_template(
+    const struct frame_ctx* ctx, const uint8_t* chars, uint line,
+    pixel_t* p) {
+    // Screen is 16 rows x 32 columns
+    // Each char is 12 x 8 pixels
+    const uint row = line / 12;      // char row
+    const uint sub_row = line % 12;  // scanline within current char row
+    const uint16_t* index = ctx->glyph_index[sub_row];
+    const uint32_t(*cells)[LUT_WORDS] = ctx->glyph_cells;
 
-                fg_colour = colour_palette_atom[colour_index];
+    uint32_t* q = (uint32_t*)p;
+    if (row < 16) {
+        for (int col = 0; col < 32; col++) {
+            q = copy_lut_entry(q, cells[index[chars[col]]]);
+        }
+    }
+    return (pixel_t*)q;
+}
 
-                uint pix_row = (SG6_INDEX == sgidx) ? 2 - (sub_row / 4)
-                                                    : 1 - (sub_row / 6);
+// Width and colour of the graphics modes, as compile time constants
+#define MODE_WIDTH(m) ((m) == 1 ? 64 : (m) == 15 ? 256 : 128)
+#define MODE_COLOUR(m) (!((m) & 0b10))
 
-                uint16_t pix0 =
-                    ((ch >> (pix_row * 2)) & 0x1) ? fg_colour : bg_colour;
-                uint16_t pix1 =
-                    ((ch >> (pix_row * 2)) & 0x2) ? fg_colour : bg_colour;
-                write_pixel4(&p, pix1);
-                write_pixel4(&p, pix0);
-            }
-        }
+#define DEFINE_GRAPHICS_RENDERER(m)                                          \
+    static pixel_t* render_graphics_##m(const struct frame_ctx* ctx,         \
+                                        const uint8_t* bytes, uint line,     \
+                                        pixel_t* p) {                        \
+        return graphics_template(ctx, bytes, p, MODE_WIDTH(m),               \
+                                 MODE_COLOUR(m));                            \
     }
-    return p;
+
+DEFINE_GRAPHICS_RENDERER(1)
+DEFINE_GRAPHICS_RENDERER(3)
+DEFINE_GRAPHICS_RENDERER(5)
+DEFINE_GRAPHICS_RENDERER(7)
+DEFINE_GRAPHICS_RENDERER(9)
+DEFINE_GRAPHICS_RENDERER(11)
+DEFINE_GRAPHICS_RENDERER(13)
+DEFINE_GRAPHICS_RENDERER(15)
+
+// The text and semigraphics modes do not depend on the graphics mode bits so
+// they share one renderer rather than taking 8 copies of it
+static pixel_t* render_text(const struct frame_ctx* ctx, const uint8_t* chars,
+                            uint line, pixel_t* p) {
+    return text_template(ctx, chars, line, p);
 }
 
+// Indexed by get_mode()
+static const line_renderer_t line_renderers[16] = {
+    render_text, render_graphics_1,  render_text, render_graphics_3,
+    render_text, render_graphics_5,  render_text, render_graphics_7,
+    render_text, render_graphics_9,  render_text, render_graphics_11,
+    render_text, render_graphics_13, render_text, render_graphics_15,
+};
+
 uint8_t* do_text_vga80(uint relative_line_num, pixel_t* p) {
     // Screen is 80 columns by 40 rows
     // Each char is 12 x 8 pixels
@@ -519,48 +777,40 @@ uint8_t* do_text_vga80(uint relative_line_num, pixel_t* p) {
         // Compute the start address of the current row in the Atom
         // framebuffer
         uint char_addr = GetVidMemBase() + 80 * row;
+        uint8_t chars[80];
+        eb_read_block(chars, char_addr, 80);
 
         // Read the VGA80 control registers
         uint vga80_ctrl1 = eb_get(COL80_FG);
         uint vga80_ctrl2 = eb_get(COL80_BG);
 
-        // *p++ = COMPOSABLE_RAW_RUN;
-        // *p++ = BLACK;    // Extra black pixel
-        // *p++ = 642 - 3;  //
-        // *p++ = BLACK;    // Extra black pixel
-
-        // For efficiency, compute two pixels at a time using a lookup table
-        // p is now on a word boundary due to the extra pixels above
-        pixel2_t* q = (pixel2_t*)p;
+        pixel4_t* q = (pixel4_t*)p;
 
         if (vga80_ctrl1 & 0x08) {
             // Attribute mode enabled, attributes follow the characters in
             // the frame buffer
-            uint attr_addr = char_addr + 80 * 40;
+            uint8_t attrs[80];
+            eb_read_block(attrs, char_addr + 80 * 40, 80);
             uint shift = (sub_row >> 1) & 0x06;  // 0, 2 or 4
             // Compute these outside of the for loop for efficiency
             uint smask0 = 0x10 >> shift;
             uint smask1 = 0x20 >> shift;
             uint ulmask = (sub_row == 10) ? 0xFF : 0x00;
             for (int col = 0; col < 80; col++) {
-                uint ch = eb_get(char_addr++);
-                uint attr = eb_get(attr_addr++);
-                pixel2_t* vp = vga80_lut + ((attr & 0x77) << 2);
+                uint ch = chars[col];
+                uint attr = attrs[col];
+                const pixel4_t* vp = vga80_lut[attr & 0x77];
+                uint b;
                 if (attr & 0x80) {
-                    // Semi Graphics
-                    pixel2_t p1 = (ch & smask1) ? *(vp + 3) : *vp;
-                    pixel2_t p0 = (ch & smask0) ? *(vp + 3) : *vp;
-                    // Unroll the writing of the four pixel pairs
-                    *q++ = p1;
-                    *q++ = p1;
-                    *q++ = p0;
-                    *q++ = p0;
+                    // Semi Graphics, a block of 4 pixels for each of the two
+                    // bits
+                    b = ((ch & smask1) ? 0xf0 : 0) | ((ch & smask0) ? 0x0f : 0);
                 } else {
 #if (PLATFORM == PLATFORM_DRAGON)
                     ch ^= 0x60;
 #endif
                     // Text
-                    uint8_t b = fd[(ch & 0x7f) * 12];
+                    b = fd[(ch & 0x7f) * 12];
                     if (ch >= 0x80) {
                         b = ~b;
                     }
@@ -568,12 +818,9 @@ uint8_t* do_text_vga80(uint relative_line_num, pixel_t* p) {
                     if (attr & 0x08) {
                         b |= ulmask;
                     }
-                    // Unroll the writing of the four pixel pairs
-                    *q++ = *(vp + ((b >> 6) & 3));
-                    *q++ = *(vp + ((b >> 4) & 3));
-                    *q++ = *(vp + ((b >> 2) & 3));
-                    *q++ = *(vp + ((b >> 0) & 3));
                 }
+                *q++ = vp[(b >> 4) & 15];
+                *q++ = vp[b & 15];
             }
         } else {
             // Attribute mode disabled, use default colours from the VGA80
@@ -582,33 +829,196 @@ uint8_t* do_text_vga80(uint relative_line_num, pixel_t* p) {
             //   colour bits 2..0 of VGA80_CTRL2 (#BDE5) are the default
             //   background colour
             uint attr = ((vga80_ctrl2 & 7) << 4) | (vga80_ctrl1 & 7);
-            pixel2_t* vp = vga80_lut + (attr << 2);
+            const pixel4_t* vp = vga80_lut[attr];
             for (int col = 0; col < 80; col++) {
-                uint ch = eb_get(char_addr++);
+                uint ch = chars[col];
                 bool inv = (ch & INV_MASK) ? true : false;
 
 #if (PLATFORM == PLATFORM_DRAGON)
                 ch ^= 0x40;
 #endif
-                uint8_t b = fd[(ch & 0x7f) * 12];
+                uint b = fd[(ch & 0x7f) * 12];
                 if (inv) {
                     b = ~b;
                 }
-                // Unroll the writing of the four pixel pairs
-                *q++ = *(vp + ((b >> 6) & 3));
-                *q++ = *(vp + ((b >> 4) & 3));
-                *q++ = *(vp + ((b >> 2) & 3));
-                *q++ = *(vp + ((b >> 0) & 3));
+                *q++ = vp[(b >> 4) & 15];
+                *q++ = vp[b & 15];
             }
         }
     }
-    // The above loops add 80 x 4 = 320 32-bit words, which is 640 16-bit
-    // words
-    return p + 640;
+    // The above loops add 80 x 2 cells of 4 pixels
+    return p + PIXEL_BYTES(640);
+}
+
+// Drawn 6847 lines are kept at native resolution so that lines whose video
+// memory has not changed since can be copied instead of drawn again.
+#define CACHE_LINES 192
+#define CACHE_WIDTH 256
+
+// The most bytes of video memory a 6847 line is drawn from, see
+// bytes_per_row()
+#define LINE_BYTES 32
+
+// Changes to anything other than video memory that affects the drawn lines
+// bump the cache epoch
+static volatile uint32_t cache_epoch = 1;
+
+// A line is only copied from the cache if it would be drawn from the same
+// video memory bytes, which are kept with it. So the cache needs no bus
+// events, and video memory writes are not notified. The bytes are read once,
+// into the key, and the line is drawn from the key, so a write between
+// planning and painting a line cannot leave pixels cached under the wrong
+// bytes.
+struct line_key {
+    uint32_t epoch;
+    uint16_t address;
+    uint8_t mode;
+    bool alt;
+    uint8_t bytes[LINE_BYTES];
+};
+
+static struct line_key cache_keys[CACHE_LINES];
+static uint32_t line_cache[CACHE_LINES][CACHE_WIDTH / 4];
+
+void mc6847_invalidate() { cache_epoch++; }
+
+/// @brief bump the cache epoch if any of the settings have changed
+static inline void check_settings() {
+    struct settings {
+        pixel_t* palette;
+        uint16_t ink;
+        uint16_t paper;
+        uint16_t ink_alt;
+        uint8_t fontno;
+        uint8_t max_lower;
+        uint8_t artifact;
+        bool support_lower;
+    };
+    static struct settings prev;
+    struct settings current;
+    memset(&current, 0, sizeof(current));
+    current.palette = colour_palette;
+    current.ink = ink;
+    current.paper = paper;
+    current.ink_alt = ink_alt;
+    current.fontno = fontno;
+    current.max_lower = max_lower;
+    current.artifact = artifact;
+    current.support_lower = support_lower;
+    if (memcmp(&current, &prev, sizeof(current))) {
+        prev = current;
+        cache_epoch++;
+    }
+}
+
+static inline void get_line_key(int mode, int address, struct line_key* key) {
+    key->epoch = cache_epoch;
+    key->address = address;
+    key->mode = mode;
+    key->alt = frame_ctx.alt;
+    eb_read_block(key->bytes, address, bytes_per_row(mode));
+}
+
+/// @brief copy a line from the cache if it is still valid
+/// @param cache_line the native line number
+/// @param key identifies the content of the line
+/// @param p output buffer
+/// @return true if the line was copied
+static inline bool cache_lookup(int cache_line, const struct line_key* key,
+                                pixel_t* p) {
+    const struct line_key* k = &cache_keys[cache_line];
+    if (k->epoch != key->epoch || k->address != key->address ||
+        k->mode != key->mode || k->alt != key->alt ||
+        memcmp(k->bytes, key->bytes, bytes_per_row(key->mode))) {
+        return false;
+    }
+    const uint32_t* src = line_cache[cache_line];
+#if NATIVE_SCANOUT || PACKED_PIXELS
+    memcpy(p, src, CACHE_WIDTH);
+#elif (XSCALE == 2)
+    uint32_t* q = (uint32_t*)p;
+    for (int i = 0; i < CACHE_WIDTH / 4; i++) {
+        uint32_t x = *src++;
+        *q++ = ((x & 0xFF) | ((x & 0xFF00) << 8)) * 0x101;
+        *q++ = (((x >> 16) & 0xFF) | ((x >> 8) & 0xFF0000)) * 0x101;
+    }
+#elif (XSCALE == 3)
+    // each word of 4 pixels makes 3 words of 12
+    uint32_t* q = (uint32_t*)p;
+    for (int i = 0; i < CACHE_WIDTH / 4; i++) {
+        const uint32_t x = *src++;
+        const uint32_t b = (x >> 8) & 0xFF;
+        const uint32_t c = (x >> 16) & 0xFF;
+        *q++ = (x & 0xFF) * 0x010101 | b << 24;
+        *q++ = b * 0x0101 | c * 0x01010000;
+        *q++ = c | (x >> 24) * 0x01010100;
+    }
+#else
+    const pixel_t* b = (const pixel_t*)src;
+    for (int i = 0; i < CACHE_WIDTH; i++) {
+        for (int j = 0; j < XSCALE; j++) {
+            *p++ = b[i];
+        }
+    }
+#endif
+    return true;
 }
 
-void draw_line(int line_num, int mode, int atom_fb, uint8_t* p) {
+/// @brief save a newly drawn line in the cache
+/// @param cache_line the native line number
+/// @param key identifies the content of the line, taken before drawing it
+/// @param p the drawn pixels
+static inline void cache_store(int cache_line, const struct line_key* key,
+                               const pixel_t* p) {
+    uint32_t* dst = line_cache[cache_line];
+#if NATIVE_SCANOUT || PACKED_PIXELS
+    memcpy(dst, p, CACHE_WIDTH);
+#elif (XSCALE == 2)
+    const uint32_t* q = (const uint32_t*)p;
+    for (int i = 0; i < CACHE_WIDTH / 4; i++) {
+        uint32_t w0 = *q++;
+        uint32_t w1 = *q++;
+        *dst++ = (w0 & 0xFF) | ((w0 >> 8) & 0xFF00) | ((w1 & 0xFF) << 16) |
+                 ((w1 << 8) & 0xFF000000);
+    }
+#elif (XSCALE == 3)
+    const uint32_t* q = (const uint32_t*)p;
+    for (int i = 0; i < CACHE_WIDTH / 4; i++) {
+        const uint32_t w0 = *q++;
+        const uint32_t w1 = *q++;
+        const uint32_t w2 = *q++;
+        *dst++ = (w0 & 0xFF) | ((w0 >> 16) & 0xFF00) | (w1 & 0xFF0000) |
+                 ((w2 << 16) & 0xFF000000);
+    }
+#else
+    pixel_t* b = (pixel_t*)dst;
+    for (int i = 0; i < CACHE_WIDTH; i++) {
+        b[i] = p[i * XSCALE];
+    }
+#endif
+    cache_keys[cache_line] = *key;
+}
+
+/// What needs doing to draw a 6847 line, worked out in line order by
+/// plan_line() so that the drawing itself depends on nothing but the plan
+struct line_plan {
+    struct frame_ctx ctx;
+    struct line_key key;
+    line_renderer_t renderer;  // NULL for a border line
+    int cache_line;
+    pixel_t border_colour;
+};
+
+/// @brief work out how to draw a line of the 6847 display
+/// @param line_num the line number
+/// @param mode the 6847 mode
+/// @param atom_fb the 6502 address of the frame buffer
+/// @param plan filled in if the line needs drawing
+/// @return false if the line repeats the previous line and needs no drawing
+static bool plan_line(int line_num, int mode, int atom_fb,
+                      struct line_plan* plan) {
     static int prev_mode = 0;
+    static int prev_line_num = -1;
     static int border_colour = 0;
     static int mem_reg = 0;
     static int counter = 99;
@@ -619,22 +1029,35 @@ void draw_line(int line_num, int mode, int atom_fb, uint8_t* p) {
         counter = lines_per_row(mode);
     }
 
-    if (relative_line_num < 0 || relative_line_num >= max_height) {
+    if (line_num == 0) {
+        check_settings();
+        setup_frame_ctx();
+    }
+
+    // Each 6847 line is YSCALE output lines high. Only the first of them is
+    // drawn, the rest are scanned out again from the same buffer.
+    const bool repeat = (relative_line_num % YSCALE) != 0 &&
+                        line_num == prev_line_num + 1 && mode == prev_mode;
+    prev_line_num = line_num;
+
+    if (repeat) {
+        // nothing to draw
+    } else if (relative_line_num < 0 || relative_line_num >= max_height) {
         // Add top/bottom borders
-        add_border(p, border_colour, MODE_H_ACTIVE_PIXELS);
-    } else if (!(mode & 1))  // Alphanumeric or Semigraphics
-    {
-        border_colour = AT_BLACK;
-        p = add_border(p, border_colour, horizontal_offset);
-        p = do_text(mode, atom_fb + mem_reg, border_colour,
-                    relative_line_num / YSCALE, p);
-        p = add_border(p, border_colour, horizontal_offset);
+        plan->renderer = NULL;
+        plan->border_colour = border_colour;
     } else {
-        border_colour = colour_palette[0];
-        p = add_border(p, border_colour, horizontal_offset);
-        p = do_graphics(p, mode, atom_fb + mem_reg, border_colour,
-                        relative_line_num * 2 / YSCALE);
-        p = add_border(p, border_colour, horizontal_offset);
+        if (!(mode & 1)) {
+            // Alphanumeric or Semigraphics
+            border_colour = AT_BLACK;
+        } else {
+            border_colour = colour_palette[0];
+        }
+        plan->ctx = frame_ctx;
+        plan->renderer = line_renderers[mode];
+        plan->border_colour = border_colour;
+        plan->cache_line = relative_line_num / YSCALE;
+        get_line_key(mode, atom_fb + mem_reg, &plan->key);
     }
 
     counter--;
@@ -643,6 +1066,38 @@ void draw_line(int line_num, int mode, int atom_fb, uint8_t* p) {
         mem_reg += bytes_per_row(mode);
         prev_mode = mode;
     }
+    return !repeat;
+}
+
+/// @brief draw a line of the 6847 display as planned, only the active area
+/// is drawn, the borders are left to the HSTX
+/// @param plan from plan_line()
+/// @param line buffer for LINE_BUFFER_WORDS words
+/// @return number of words in the line's command list
+static uint32_t paint_line(const struct line_plan* plan, uint32_t* line) {
+    if (!plan->renderer) {
+        return line_solid(line, plan->border_colour);
+    }
+    pixel_t* p = line_pixels(line);
+    if (!cache_lookup(plan->cache_line, &plan->key, p)) {
+        plan->renderer(&plan->ctx, plan->key.bytes, plan->cache_line, p);
+        cache_store(plan->cache_line, &plan->key, p);
+    }
+#if NATIVE_SCANOUT
+    return line_finish_doubled(line, horizontal_offset, max_width,
+                               plan->border_colour);
+#else
+    return line_finish(line, horizontal_offset, max_width,
+                       plan->border_colour);
+#endif
+}
+
+uint32_t draw_line(int line_num, int mode, int atom_fb, uint32_t* line) {
+    struct line_plan plan;
+    if (!plan_line(line_num, mode, atom_fb, &plan)) {
+        return 0;
+    }
+    return paint_line(&plan, line);
 }
 
 static inline void ascii_to_atom(char* str) {
@@ -676,9 +1131,8 @@ void mc6847_outc(char c) {
     }
 
     if (c == '\f') {
-        for (int i = FB_ADDR; i < FB_ADDR + 80 * 40; i++) {
-            eb_set(i, 32);
-        }
+        eb_memset(FB_ADDR, 32, 80 * 40);
+        mc6847_invalidate();
         row = 0;
         col = 0;
         return;
@@ -698,6 +1152,7 @@ void mc6847_outc(char c) {
     }
 
     eb_set(0x8000 + row * 80 + col, c);
+    mc6847_invalidate();
     col += 1;
     if (col == 80) {
         col = 0;
@@ -715,89 +1170,412 @@ void mc6847_print(const char* str) {
     }
 }
 
+/// @brief check whether a line has been painted
+/// @param seq the sequence number of the line
+static inline bool line_ready(uint32_t seq) {
+    const int slot = seq % LINE_BUFFER_POOL_COUNT;
+    return line_planned[slot] == seq &&
+           buffer_painted[line_buffer_index[slot]] == line_source[slot];
+}
+
 /// @brief Called from the DMA IRQ routine.
-/// Get the pixels for the given line number and add the line number to the
-/// event queue.
+/// Get the HSTX commands for the given line number and add the line number to
+/// the event queue. If the line has not been rendered in time the previous
+/// line is scanned out again.
 /// @param line_num the line number
-/// @return MODE_H_ACTIVE_PIXELS pixels
-pixel_t* mc6847_get_line_buffer(const int line_num) {
+/// @param words set to the number of words in the list
+/// @return the list of commands
+const uint32_t* mc6847_get_line_buffer(const int line_num, uint* words) {
+    if (line_num < 0) {
+        queue_try_add(&line_request_queue, &line_num);
+        return NULL;
+    }
+
+    if (line_num == 0) {
+        frame_seq += MODE_V_ACTIVE_LINES;
+        line_stats.min_slack = frame_min_slack;
+        line_stats.max_slack = frame_max_slack;
+        frame_min_slack = LINE_BUFFER_POOL_COUNT;
+        frame_max_slack = -MODE_V_ACTIVE_LINES;
+    }
+    const uint32_t seq = frame_seq + line_num;
+    render_stats_request(seq);
+    scanout_seq = seq;
     queue_try_add(&line_request_queue, &line_num);
-    if (line_num >= 0) {
-        int buf_index = line_num % LINE_BUFFER_POOL_COUNT;
-        return line_buffer_pool[buf_index];
+
+    // slack is the number of lines ready after this one, -1 if this one is
+    // late
+    int slack = -1;
+    while (slack < LINE_BUFFER_POOL_COUNT - 1 && line_ready(seq + slack + 1)) {
+        slack++;
+    }
+    if (slack < frame_min_slack) frame_min_slack = slack;
+    if (slack > frame_max_slack) frame_max_slack = slack;
+
+    scanout_prev = scanout_buf;
+    if (slack >= 0) {
+        const int buffer = line_buffer_index[seq % LINE_BUFFER_POOL_COUNT];
+        scanout_buf = line_buffer_pool[buffer];
+        scanout_words = line_buffer_words[buffer];
     } else {
-        return NULL;
+        line_stats.late_lines++;
+        if (scanout_buf) {
+            line_stats.repeated_lines++;
+        } else {
+            line_stats.blank_lines++;
+            *words = blank_line_words;
+            return blank_line;
+        }
     }
+    *words = scanout_words;
+    return scanout_buf;
 }
 
-void mc6847_reset() { reset_vga80(); }
+void mc6847_get_line_stats(struct mc6847_line_stats* stats) {
+    *stats = line_stats;
+}
+
+void mc6847_reset() {
+    reset_vga80();
+    mc6847_invalidate();
+    mc6847_mode_write();
+}
 
 void mc6847_vga_mode() {
     eb_set(COL80_BASE, COL80_ON);
     eb_set(COL80_FG, 0xba);
     eb_set(COL80_BG, 0);
     eb_set(COL80_STAT, 0x12);
-    for (int i = 0x8c80; i< 0x8c80+80*40; i++) {
-        eb_set(i, 23);
-    }
+    eb_memset(0x8c80, 23, 80 * 40);
+    mc6847_invalidate();
+    mc6847_mode_write();
+}
+
+static void mode_write(uint16_t address, void* ctx) { mc6847_mode_write(); }
+
+/// @brief called when bus events were lost, any of which may have changed the
+/// mode, so everything is drawn again
+static void events_dropped(uint32_t dropped) {
+    mc6847_invalidate();
+    mc6847_mode_write();
+    teletext_invalidate();
 }
 
-void mc6847_init(bool vdu_ram_enabled, bool emulate_reset) {
+void mc6847_init(bool vdu_ram_enabled, bool emulate_reset, bool teletext) {
     printf("mc6847_init\n");
+    bool ok = eb_register_write_handler(PIA_ADDR, 1, mode_write, NULL);
+    ok &= eb_register_write_handler(PIA_ADDR + 2, 1, mode_write, NULL);
+    ok &= eb_register_write_handler(COL80_BASE, 1, mode_write, NULL);
+    hard_assert(ok);
+    (void)ok;  // when hard_assert() is compiled out
     teletext_init();
+    teletext_renderer = teletext;
 
-    queue_init(&line_request_queue, sizeof(int), LINE_BUFFER_POOL_COUNT);
+    vertical_offset = (MODE_V_ACTIVE_LINES - max_height) / 2;
+    horizontal_offset = (MODE_H_ACTIVE_PIXELS - max_width) / 2;
+    blank_line_words = line_solid(blank_line, AT_BLACK);
+    frame_seq = -MODE_V_ACTIVE_LINES;
 
-    if (vdu_ram_enabled) {
-        eb_set_perm(FB_ADDR, EB_PERM_READ_WRITE, VID_MEM_SIZE);
-    } else {
-        eb_set_perm(FB_ADDR, EB_PERM_WRITE_ONLY, VID_MEM_SIZE);
+    queue_init(&line_request_queue, sizeof(int), LINE_BUFFER_POOL_COUNT);
+    for (int i = 0; i < LINE_BUFFER_POOL_COUNT; i++) {
+        line_planned[i] = -1;
     }
+    for (int i = 0; i < LINE_BUFFER_COUNT; i++) {
+        buffer_painted[i] = -1;
+    }
+
+    // Only the teletext CRTC registers in video memory are events, the line
+    // cache and teletext see changes to the rest by reading it. A trace
+    // records the writes to all of it.
+    const enum eb_perm perm =
+        vdu_ram_enabled ? EB_PERM_READ_WRITE : EB_PERM_WRITE_ONLY;
+    const enum eb_perm notify = vdu_ram_enabled ? EB_PERM_READ_WRITE_NOTIFY
+                                                : EB_PERM_WRITE_NOTIFY;
+#if BUS_TRACE
+    eb_set_perm(FB_ADDR, notify, VID_MEM_SIZE);
+#else
+    eb_set_perm(FB_ADDR, perm, VID_MEM_SIZE);
+    eb_set_perm(TELETEXT_CRTA, notify, TELETEXT_CRTB + 1 - TELETEXT_CRTA);
+#endif
 
     eb_set_perm(0xF000, EB_PERM_WRITE_ONLY, 0x400);
-    eb_set_perm_byte(PIA_ADDR, EB_PERM_WRITE_ONLY);
-    eb_set_perm_byte(PIA_ADDR + 2, EB_PERM_WRITE_ONLY);
+    eb_set_perm_byte(PIA_ADDR, EB_PERM_WRITE_NOTIFY);
+    eb_set_perm_byte(PIA_ADDR + 2, EB_PERM_WRITE_NOTIFY);
+    // only the mode register, the colours are read each frame
     eb_set_perm(COL80_BASE, EB_PERM_READ_WRITE, 16);
+    eb_set_perm_byte(COL80_BASE, EB_PERM_READ_WRITE_NOTIFY);
     if (emulate_reset) {
         mc6847_print("\fACORN ATOM");
     }
     initialize_vga80();
 
+    eb_set_drop_handler(events_dropped);
     eb_init(pio1);
 }
 
-#define VSYNC_ON (192 * 2 + vertical_offset)
+#define VSYNC_ON (192 * YSCALE + vertical_offset)
 #define VSYNC_OFF 0
 
-// run the emulation - can be run from both cores simultaneously
+// Set when one of the registers that select the mode is written
+static volatile bool mode_written = true;
+
+void mc6847_mode_write() { mode_written = true; }
+
+// Lines are painted as jobs, one per line in flight, so that core 1 can paint
+// some of them in its spare time. Core 0 plans every line in order and then
+// paints whatever core 1 has not claimed, oldest first.
+enum job_state { JOB_FREE, JOB_QUEUED, JOB_CLAIMED };
+
+struct line_job;
+
+/// @brief paint a planned line
+/// @param job the plan
+/// @param line buffer for LINE_BUFFER_WORDS words
+/// @return number of words in the line's command list
+typedef uint32_t (*line_painter_t)(const struct line_job* job, uint32_t* line);
+
+struct line_job {
+    volatile uint32_t state;
+    uint32_t seq;
+    int line_num;
+    int buffer;
+    int stats_mode;
+    line_painter_t paint;
+    struct line_plan plan;
+};
+
+static struct line_job line_jobs[LINE_BUFFER_POOL_COUNT];
+
+static inline bool claim_job(struct line_job* job) {
+    uint32_t expected = JOB_QUEUED;
+    return __atomic_compare_exchange_n(&job->state, &expected, JOB_CLAIMED,
+                                       false, __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED);
+}
+
+static inline void paint_job(struct line_job* job) {
+#if RENDER_STATS
+    const uint32_t start = render_stats_cycles();
+    line_buffer_words[job->buffer] =
+        job->paint(job, line_buffer_pool[job->buffer]);
+    render_stats_painted(job->stats_mode, job->seq, start,
+                         render_stats_cycles(),
+                         (int32_t)(scanout_seq - job->seq) >= 0);
+#else
+    line_buffer_words[job->buffer] =
+        job->paint(job, line_buffer_pool[job->buffer]);
+#endif
+    __dmb();
+    buffer_painted[job->buffer] = job->seq;
+    __atomic_store_n(&job->state, JOB_FREE, __ATOMIC_RELEASE);
+}
+
+/// @brief paint every queued line, or wait for core 1 to finish painting
+/// it, so that the tables their plans point to can be rebuilt. The plans
+/// copy the pointers in frame_ctx, not the tables.
+static void finish_jobs() {
+    for (int i = 0; i < LINE_BUFFER_POOL_COUNT; i++) {
+        struct line_job* job = &line_jobs[i];
+        while (job->state != JOB_FREE) {
+            if (claim_job(job)) {
+                paint_job(job);
+            }
+        }
+    }
+}
+
+/// @brief plan a whole display line
+/// @param line_num the line number
+/// @param job filled in with the plan, paint is left NULL if the line has
+/// already been drawn
+/// @param line buffer for LINE_BUFFER_WORDS words
+/// @return false if the line repeats the previous line and nothing is drawn
+typedef bool (*frame_renderer_t)(int line_num, struct line_job* job,
+                                 uint32_t* line);
+
+static int frame_mode;
+
+// the mode lines are counted against by render_stats
+static int stats_mode;
+
+static uint32_t paint_vga80(const struct line_job* job, uint32_t* line) {
+    // 40 rows of 12 lines, 640 pixels wide
+    if (job->line_num >= 40 * 12) {
+        return line_solid(line, AT_BLACK);
+    }
+    do_text_vga80(job->line_num, line_pixels(line));
+    return line_finish(line, 0, 640, AT_BLACK);
+}
+
+static bool render_vga80(int line_num, struct line_job* job, uint32_t* line) {
+    job->paint = paint_vga80;
+    return true;
+}
+
+// teletext keeps state from line to line so is drawn straight away
+static bool render_teletext(int line_num, struct line_job* job,
+                            uint32_t* line) {
+    const uint32_t start = render_stats_cycles();
+    do_teletext(line_pixels(line), MODE_H_ACTIVE_PIXELS, line_num,
+                eb_get(TELETEXT_REG_FLAGS));
+    line_buffer_words[job->buffer] =
+        line_finish(line, 0, MODE_H_ACTIVE_PIXELS, AT_BLACK);
+    render_stats_painted(RENDER_STATS_TELETEXT, job->seq, start,
+                         render_stats_cycles(),
+                         (int32_t)(scanout_seq - job->seq) >= 0);
+    return true;
+}
+
+static uint32_t paint_6847(const struct line_job* job, uint32_t* line) {
+    return paint_line(&job->plan, line);
+}
+
+static bool render_6847(int line_num, struct line_job* job, uint32_t* line) {
+    job->paint = paint_6847;
+    return plan_line(line_num, frame_mode, _calc_fb_base(), &job->plan);
+}
+
+static frame_renderer_t select_renderer() {
+    mode_written = false;
+    frame_mode = get_mode();
+    setup_frame_ctx();
+    if (eb_get(COL80_BASE) & COL80_ON) {
+        stats_mode = RENDER_STATS_VGA80;
+        return render_vga80;
+    }
+    if (teletext_renderer) {
+        stats_mode = RENDER_STATS_TELETEXT;
+        return render_teletext;
+    }
+    stats_mode = frame_mode;
+    return render_6847;
+}
+
+/// @brief give a line a buffer and queue it to be painted
+/// @param next the line number
+/// @param seq the sequence number of the line
+static inline void render_line(int next, uint32_t seq) {
+    // Buffers are used in rotation, skipping the one being scanned out and
+    // the one before it, which the DMA may still be reading. The buffer
+    // chosen is always the least recently used one, which holds neither a
+    // line in flight nor, if the line now being scanned out was late, the
+    // line being repeated in its place. Only one of the two skipped buffers
+    // can be outside the lines in flight, so one spare buffer is enough. A
+    // line that repeats the previous one does not use a buffer.
+    static int next_buffer = 0;
+    static frame_renderer_t renderer;
+
+    const int slot = seq % LINE_BUFFER_POOL_COUNT;
+    struct line_job* job = &line_jobs[slot];
+
+    // The line that last used this slot must have been painted before the
+    // slot is reused. It may still be queued when catching up on many lines.
+    while (job->state != JOB_FREE) {
+        if (claim_job(job)) {
+            paint_job(job);
+        }
+    }
+
+    if (next == 0 || mode_written) {
+        renderer = select_renderer();
+    }
+    while (line_buffer_pool[next_buffer] == scanout_buf ||
+           line_buffer_pool[next_buffer] == scanout_prev) {
+        next_buffer = (next_buffer + 1) % LINE_BUFFER_COUNT;
+    }
+    job->seq = seq;
+    job->line_num = next;
+    job->buffer = next_buffer;
+    job->stats_mode = stats_mode;
+    job->paint = NULL;
+    const bool drawn = renderer(next, job, line_buffer_pool[next_buffer]);
+
+    if (drawn) {
+        line_buffer_index[slot] = next_buffer;
+        line_source[slot] = seq;
+        next_buffer = (next_buffer + 1) % LINE_BUFFER_COUNT;
+        __dmb();
+        if (job->paint) {
+            __atomic_store_n(&job->state, JOB_QUEUED, __ATOMIC_RELEASE);
+        } else {
+            buffer_painted[job->buffer] = seq;
+        }
+    } else {
+        const int prev = (seq - 1) % LINE_BUFFER_POOL_COUNT;
+        line_buffer_index[slot] = line_buffer_index[prev];
+        line_source[slot] = line_source[prev];
+    }
+    __dmb();
+    line_planned[slot] = seq;
+    planned_seq = seq;
+}
+
+bool mc6847_render_spare(uint32_t deadline_us) {
+    // a safe guess until a line has been timed
+    static uint32_t worst_us = 10;
+
+    uint32_t start = time_us_32();
+    if ((int32_t)(deadline_us - start) <= (int32_t)worst_us) {
+        return false;
+    }
+    // Newest first, and never the next line due to be scanned out, which is
+    // left to core 0
+    const uint32_t newest = planned_seq;
+    for (uint32_t seq = newest; (int32_t)(seq - scanout_seq) > 1; seq--) {
+        struct line_job* job = &line_jobs[seq % LINE_BUFFER_POOL_COUNT];
+        if (claim_job(job)) {
+            paint_job(job);
+            line_stats.core1_lines++;
+            uint32_t elapsed = time_us_32() - start;
+            if (elapsed > worst_us) {
+                worst_us = elapsed;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief render up to LINE_BUFFER_POOL_COUNT - 1 lines ahead of the line
+/// being scanned out
+static inline void render_ahead() {
+    static uint32_t next_seq = 0;
+    static int next_line = 0;
+
+    // Every line is planned in order, so after a late line (or a lost
+    // request) this catches up
+    const uint32_t last = scanout_seq + LINE_BUFFER_POOL_COUNT - 1;
+    while ((int32_t)(last - next_seq) >= 0) {
+        render_line(next_line, next_seq++);
+        next_line = (next_line + 1) % MODE_V_ACTIVE_LINES;
+    }
+    // then paint the lines core 1 has not taken, oldest first
+    for (uint32_t seq = next_seq - LINE_BUFFER_POOL_COUNT; seq != next_seq;
+         seq++) {
+        struct line_job* job = &line_jobs[seq % LINE_BUFFER_POOL_COUNT];
+        if (claim_job(job)) {
+            paint_job(job);
+        }
+    }
+}
+
+// run the emulation
 void mc6847_run() {
+    render_stats_init();
     while (1) {
         int line_num;
         queue_remove_blocking(&line_request_queue, &line_num);
 
         if (line_num >= 0) {
-            const int next =
-                (line_num + LINE_BUFFER_POOL_COUNT - 1) % MODE_V_ACTIVE_LINES;
-            int buf_index = next % LINE_BUFFER_POOL_COUNT;
-            char* p = line_buffer_pool[buf_index];
-            int mode = get_mode();
-            int atom_fb = _calc_fb_base();
-            if (eb_get(COL80_BASE) & COL80_ON) {
-                do_text_vga80(next, p);
-            } else {
-#ifdef TELETEXT
-                do_teletext(p, MODE_H_ACTIVE_PIXELS, next,
-                            eb_get(TELETEXT_REG_FLAGS));
-#else
-                draw_line(next, mode, atom_fb, p);
-#endif
-            }
+            render_ahead();
         }
 
+#if !GENLOCK
         if (line_num == VSYNC_ON) {
             gpio_put(PIN_VSYNC, false);
         } else if (line_num == VSYNC_OFF) {
             gpio_put(PIN_VSYNC, true);
         }
+#endif
     }
 }
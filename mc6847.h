@@ -27,8 +27,15 @@ Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
 
 #include "videomode.h"
 
-/// @brief initialise
-void mc6847_init(bool vdu_ram_enabled, bool emulate_reset);
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @brief initialise for the video mode selected
+/// @param vdu_ram_enabled the Atom can read back video memory
+/// @param emulate_reset print the boot message
+/// @param teletext draw the SAA5050 teletext page in place of the 6847
+void mc6847_init(bool vdu_ram_enabled, bool emulate_reset, bool teletext);
 
 /// @brief run the emulation (does not return)
 void mc6847_run();
@@ -50,11 +57,64 @@ void mc6847_outc(char c);
 /// @param y 
 void mc6847_moveto(int x, int y);
 
-/// @brief get a display line of pixels
+/// @brief get a display line as a list of HSTX commands
 /// @param line_num the line number
-/// @return pointer to a buffer containg the pixels
-pixel_t* mc6847_get_line_buffer(int line_num);
-
-void draw_line(int line_num, int mode, int atom_fb, unsigned char* p);
+/// @param words set to the number of words in the list
+/// @return pointer to the list
+const uint32_t* mc6847_get_line_buffer(int line_num, unsigned int* words);
+
+/// @brief counts of lines that were not rendered in time
+struct mc6847_line_stats {
+    uint32_t late_lines;      ///< lines not ready when scanout started
+    uint32_t repeated_lines;  ///< late lines replaced by the previous line
+    uint32_t blank_lines;     ///< late lines replaced by a blank line
+    int min_slack;  ///< fewest lines ready ahead during the last frame, -1
+                    ///< if a line was late
+    int max_slack;  ///< most lines ready ahead during the last frame
+    uint32_t core1_lines;  ///< lines painted by mc6847_render_spare()
+};
+
+/// @brief paint a line that is waiting to be rendered, if there is one and
+/// there is time. Called from core 1 in its spare time.
+/// @param deadline_us value of time_us_32() by which core 1 must be finished
+/// @return true if a line was painted
+bool mc6847_render_spare(uint32_t deadline_us);
+
+/// @brief get the line rendering statistics
+/// @param stats filled in with the current values
+void mc6847_get_line_stats(struct mc6847_line_stats* stats);
+
+/// @brief draw a line of the 6847 display
+/// @param line_num the line number
+/// @param mode the 6847 mode
+/// @param atom_fb the 6502 address of the frame buffer
+/// @param line buffer for LINE_BUFFER_WORDS words, see hstx_line.h
+/// @return the number of words in the line's list of HSTX commands, 0 if the
+/// line repeats the previous line and nothing was drawn
+uint32_t draw_line(int line_num, int mode, int atom_fb, uint32_t* line);
+
+/// @brief draw a line of the VGA80 display
+/// @param relative_line_num the line number
+/// @param p buffer for MODE_H_ACTIVE_PIXELS pixels, lines below the 40th row
+/// are left alone
+/// @return the end of the pixels drawn
+unsigned char* do_text_vga80(unsigned int relative_line_num,
+                             unsigned char* p);
+
+/// @brief get the 6847 mode the PIA selects
+/// @return the mode, 0 to 15
+int get_mode();
+
+/// @brief discard all cached lines, needed after a change that affects the
+/// drawn lines other than to video memory or the mode registers
+void mc6847_invalidate();
+
+/// @brief note a 6502 write to a register that selects the display mode,
+/// called from the bus event handler
+void mc6847_mode_write();
+
+#ifdef __cplusplus
+}
+#endif
 
 #define PIN_VSYNC 20
\ No newline at end of file
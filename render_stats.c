@@ -0,0 +1,156 @@
+/*
+
+Scanline deadline instrumentation
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "render_stats.h"
+
+#if RENDER_STATS
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/sync.h"
+#include "pico/platform.h"
+
+// Render times are binned by powers of 2, from under 1024 cycles up
+#define BIN_SHIFT 10
+#define BIN_COUNT 12
+
+struct mode_stats {
+    uint32_t lines;
+    uint64_t total_cycles;
+    uint32_t worst_cycles;
+    uint32_t late;  // painted after the line's DMA was set up
+    uint32_t core1_lines;
+    int32_t min_slack;  // cycles between painting and DMA, core 0 lines only
+    uint32_t bins[BIN_COUNT];
+};
+
+static struct mode_stats stats[RENDER_STATS_MODES];
+
+// When each of the recent lines was painted by core 0. The cycle counters of
+// the two cores are not comparable, so slack is only measured for lines
+// painted by core 0, which also takes the DMA IRQ.
+#define RECENT_LINES 16
+static struct {
+    uint32_t seq;
+    uint32_t end;
+    uint8_t mode;
+} painted[RECENT_LINES];
+
+static void clear_stats() {
+    memset(stats, 0, sizeof(stats));
+    for (int i = 0; i < RENDER_STATS_MODES; i++) {
+        stats[i].min_slack = INT32_MAX;
+    }
+    for (int i = 0; i < RECENT_LINES; i++) {
+        painted[i].seq = -1;
+    }
+}
+
+void render_stats_init() {
+    static bool cleared = false;
+    if (!cleared) {
+        clear_stats();
+        cleared = true;
+    }
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_cyccnt = 0;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+}
+
+void __not_in_flash_func(render_stats_request)(uint32_t seq) {
+    const uint32_t now = render_stats_cycles();
+    const int i = seq % RECENT_LINES;
+    if (painted[i].seq == seq) {
+        struct mode_stats* s = &stats[painted[i].mode];
+        const int32_t slack = now - painted[i].end;
+        if (slack < s->min_slack) {
+            s->min_slack = slack;
+        }
+    }
+}
+
+void __not_in_flash_func(render_stats_painted)(int mode, uint32_t seq,
+                                               uint32_t start, uint32_t end,
+                                               bool late) {
+    struct mode_stats* s = &stats[mode];
+    const uint32_t cycles = end - start;
+    s->lines++;
+    s->total_cycles += cycles;
+    if (cycles > s->worst_cycles) {
+        s->worst_cycles = cycles;
+    }
+    if (late) {
+        s->late++;
+    }
+    int bin = 0;
+    while (bin < BIN_COUNT - 1 && (cycles >> (BIN_SHIFT + bin))) {
+        bin++;
+    }
+    s->bins[bin]++;
+
+    if (get_core_num() == 0) {
+        const int i = seq % RECENT_LINES;
+        painted[i].end = end;
+        painted[i].mode = mode;
+        __dmb();
+        painted[i].seq = seq;
+    } else {
+        s->core1_lines++;
+    }
+}
+
+void render_stats_print() {
+    struct mode_stats copy[RENDER_STATS_MODES];
+    memcpy(copy, stats, sizeof(copy));
+    clear_stats();
+
+    printf("mode      lines    mean   worst   min slack    late   core1\n");
+    for (int m = 0; m < RENDER_STATS_MODES; m++) {
+        const struct mode_stats* s = &copy[m];
+        if (s->lines == 0) {
+            continue;
+        }
+        const char* name = m == RENDER_STATS_VGA80      ? "vga80"
+                           : m == RENDER_STATS_TELETEXT ? "teletext"
+                           : (m & 1)                    ? "graphics"
+                                                        : "text";
+        printf("%2d %-8s %7lu %7lu %7lu %11ld %7lu %7lu\n", m, name,
+               (unsigned long)s->lines,
+               (unsigned long)(s->total_cycles / s->lines),
+               (unsigned long)s->worst_cycles,
+               (long)(s->min_slack == INT32_MAX ? 0 : s->min_slack),
+               (unsigned long)s->late, (unsigned long)s->core1_lines);
+        printf("   cycles <");
+        for (int b = 0; b < BIN_COUNT; b++) {
+            if (b < BIN_COUNT - 1) {
+                printf(" %lu:%lu", 1ul << (BIN_SHIFT + b),
+                       (unsigned long)s->bins[b]);
+            } else {
+                printf(" more:%lu", (unsigned long)s->bins[b]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+#endif
@@ -0,0 +1,71 @@
+/*
+
+Scanline deadline instrumentation
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Build with RENDER_STATS=1 to time every line with the DWT cycle counter.
+// Otherwise these all compile to nothing.
+
+// Modes 0 - 15 are the 6847 modes
+#define RENDER_STATS_VGA80 16
+#define RENDER_STATS_TELETEXT 17
+#define RENDER_STATS_MODES 18
+
+#if RENDER_STATS
+
+#include "hardware/structs/m33.h"
+
+/// @brief start the cycle counter, must be called on each core that renders
+void render_stats_init();
+
+/// @brief read this core's cycle counter
+static inline uint32_t render_stats_cycles() { return m33_hw->dwt_cyccnt; }
+
+/// @brief note that a line's DMA is being set up, called from the DMA IRQ
+/// @param seq the sequence number of the line
+void render_stats_request(uint32_t seq);
+
+/// @brief note that a line has been painted
+/// @param mode the mode, see above
+/// @param seq the sequence number of the line
+/// @param start cycle count when painting started
+/// @param end cycle count when painting finished
+/// @param late true if the line's DMA had already been set up
+void render_stats_painted(int mode, uint32_t seq, uint32_t start, uint32_t end,
+                          bool late);
+
+/// @brief print the stats to stdout and start again
+void render_stats_print();
+
+#else
+
+static inline void render_stats_init() {}
+static inline uint32_t render_stats_cycles() { return 0; }
+static inline void render_stats_request(uint32_t seq) {}
+static inline void render_stats_painted(int mode, uint32_t seq, uint32_t start,
+                                        uint32_t end, bool late) {}
+static inline void render_stats_print() {}
+
+#endif
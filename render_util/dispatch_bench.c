@@ -0,0 +1,160 @@
+/*
+
+Host timing of the 6502 write dispatch in ../eb_handlers.c
+
+Registers 1, 8 and 32 windows of addresses and times dispatching writes to
+random addresses among them, against finding the window by comparing with
+each in turn as the event IRQ used to.
+
+    cmake -S render_util -B build
+    cmake --build build
+    build/dispatch_bench
+    build/dispatch_bench -n 100000000
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../eb_handlers.h"
+
+#define ADDRESS_COUNT 4096
+
+struct window {
+    uint16_t start;
+    uint16_t len;
+};
+
+static struct window windows[EB_WRITE_HANDLER_MAX];
+static uint32_t counts[EB_WRITE_HANDLER_MAX];
+static uint16_t addresses[ADDRESS_COUNT];
+
+static void count_write(uint16_t address, void* ctx) { (*(uint32_t*)ctx)++; }
+
+/// @brief the windows for a test, the first few as the Atom's devices
+/// @param n number of windows
+static void make_windows(int n) {
+    static const struct window atom[] = {
+        {0x8400, 2},       // teletext CRTC
+        {0xBDC0, 25},      // SID
+        {0x0100, 0x20},    // UI keys
+        {0xB000, 1},       // PIA
+        {0xB002, 1},
+        {0xBDE0, 1},       // 80 column mode
+    };
+    const int fixed = sizeof(atom) / sizeof(atom[0]);
+    for (int i = 0; i < n; i++) {
+        if (i < fixed) {
+            windows[i] = atom[i];
+        } else {
+            // 16 bytes at a time, sharing two fine pages
+            windows[i] = (struct window){0xA000 + (i - fixed) * 16, 16};
+        }
+    }
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/// @brief find the window by comparing with each in turn
+static inline void linear_dispatch(uint16_t address, int n) {
+    for (int i = 0; i < n; i++) {
+        if ((uint16_t)(address - windows[i].start) < windows[i].len) {
+            count_write(address, &counts[i]);
+            return;
+        }
+    }
+}
+
+/// @brief time both dispatches with n windows
+/// @param n number of windows
+/// @param events dispatches to time
+static void run(int n, long events) {
+    make_windows(n);
+    eb_clear_write_handlers();
+    for (int i = 0; i < n; i++) {
+        if (!eb_register_write_handler(windows[i].start, windows[i].len,
+                                       count_write, &counts[i])) {
+            fprintf(stderr, "could not register window %d\n", i);
+            exit(1);
+        }
+    }
+    // three quarters of the writes are to a window, as with notify
+    // permissions most writes that are not would never be events
+    for (int i = 0; i < ADDRESS_COUNT; i++) {
+        if (rand() % 4) {
+            const struct window* w = &windows[rand() % n];
+            addresses[i] = w->start + rand() % w->len;
+        } else {
+            addresses[i] = rand();
+        }
+    }
+
+    uint32_t total = 0;
+    double t = now();
+    for (long i = 0; i < events; i++) {
+        eb_dispatch_write(addresses[i & (ADDRESS_COUNT - 1)]);
+    }
+    const double table_ns = (now() - t) * 1e9 / events;
+    for (int i = 0; i < n; i++) {
+        total += counts[i];
+        counts[i] = 0;
+    }
+
+    t = now();
+    for (long i = 0; i < events; i++) {
+        linear_dispatch(addresses[i & (ADDRESS_COUNT - 1)], n);
+    }
+    const double linear_ns = (now() - t) * 1e9 / events;
+    uint32_t linear_total = 0;
+    for (int i = 0; i < n; i++) {
+        linear_total += counts[i];
+        counts[i] = 0;
+    }
+
+    printf("%2d windows  table %5.2f ns  compare %5.2f ns  handled %u%s\n", n,
+           table_ns, linear_ns, (unsigned)total,
+           total == linear_total ? "" : "  MISMATCH");
+}
+
+int main(int argc, char** argv) {
+    long events = 20000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                events = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n events]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    static const int tests[] = {1, 8, 32};
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        run(tests[i], events);
+    }
+    return 0;
+}
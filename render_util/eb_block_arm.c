@@ -0,0 +1,35 @@
+/*
+
+Build check of the DSP path of _eb_pack4() in ../atom_if.h for the RP2350's
+Cortex-M33, compiled but not run by CMakeLists.txt when arm-none-eabi-gcc
+can be found. The path itself is run on a host by eb_block_test_dsp.
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "../atom_if.h"
+
+#if !_EB_PACK4_DSP
+#error "the DSP path of _eb_pack4() is not used"
+#endif
+
+uint32_t eb_pack4_arm(uint32_t a, uint32_t b) { return _eb_pack4(a, b); }
+
+void eb_read_block_arm(uint8_t* dst, uint16_t address, size_t size) {
+    eb_read_block(dst, address, size);
+}
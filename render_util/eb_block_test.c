@@ -0,0 +1,163 @@
+/*
+
+Host test of the block accessors for the shadow memory in ../atom_if.h
+
+eb_read_block(), eb_write_block() and eb_memset() are checked against
+copying a byte at a time, from even and odd addresses, for every length up
+to 9 and for a long run, to and from buffers at each alignment. The
+permission bytes, and the data bytes either side of the block, must be left
+as they were.
+
+Built twice by CMakeLists.txt, as eb_block_test with the portable
+_eb_pack4() and as eb_block_test_dsp with the DSP extension's path, using C
+versions of UXTB16 and PKHBT. eb_block_arm.c checks that the DSP path
+builds for the RP2350 when arm-none-eabi-gcc can be found.
+
+    cmake -S render_util -B build
+    cmake --build build
+    ctest --test-dir build -R eb_block
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if EB_TEST_DSP
+#define _EB_PACK4_DSP 1
+
+static inline uint32_t _eb_uxtb16(uint32_t x) { return x & 0x00FF00FF; }
+
+static inline uint32_t _eb_pkhbt(uint32_t lo, uint32_t hi) {
+    return (lo & 0xFFFF) | (hi << 16);
+}
+#endif
+
+#include "../atom_if.h"
+
+#if _EB_PACK4_DSP
+#define PACK4_PATH "DSP"
+#else
+#define PACK4_PATH "portable"
+#endif
+
+volatile uint16_t _eb_memory[EB_BUFFER_LENGTH];
+uint eb_event_chan;
+
+#define BASE 0x4000
+#define LONG_RUN 1001
+#define MAX_LENGTH 10
+
+static uint16_t expected[EB_BUFFER_LENGTH];
+static int failures;
+
+/// @brief fill the memory, with the permission bytes different from the
+/// data bytes
+static void fill_memory() {
+    for (int i = 0; i < EB_BUFFER_LENGTH; i++) {
+        _eb_memory[i] = (uint16_t)(((i * 7 + 3) & 0xFF) << 8 | (i * 13 + 5));
+        expected[i] = _eb_memory[i];
+    }
+}
+
+static void fill_buffer(uint8_t* buffer, size_t size, uint8_t seed) {
+    for (size_t i = 0; i < size; i++) {
+        buffer[i] = seed + i * 29;
+    }
+}
+
+/// @brief compare the memory with the expected contents
+static void check_memory(const char* test, uint16_t address, size_t size,
+                         int offset) {
+    for (int i = 0; i < EB_BUFFER_LENGTH; i++) {
+        if (_eb_memory[i] != expected[i]) {
+            printf("%s at %04x, %zu bytes, buffer offset %d: %04x is %04x, "
+                   "not %04x\n",
+                   test, address, size, offset, i, _eb_memory[i], expected[i]);
+            failures++;
+            return;
+        }
+    }
+}
+
+static void test_read(uint16_t address, size_t size, int offset) {
+    uint8_t buffer[LONG_RUN + 8];
+    uint8_t want[LONG_RUN + 8];
+    fill_memory();
+    fill_buffer(buffer, sizeof(buffer), 0xA5);
+    memcpy(want, buffer, sizeof(want));
+    for (size_t i = 0; i < size; i++) {
+        want[offset + i] = expected[address + i] & 0xFF;
+    }
+    eb_read_block(buffer + offset, address, size);
+    if (memcmp(buffer, want, sizeof(want))) {
+        printf("eb_read_block at %04x, %zu bytes, buffer offset %d differs\n",
+               address, size, offset);
+        failures++;
+    }
+    check_memory("eb_read_block", address, size, offset);
+}
+
+static void test_write(uint16_t address, size_t size, int offset) {
+    uint8_t buffer[LONG_RUN + 8];
+    fill_memory();
+    fill_buffer(buffer, sizeof(buffer), 0x3C);
+    for (size_t i = 0; i < size; i++) {
+        expected[address + i] =
+            (expected[address + i] & 0xFF00) | buffer[offset + i];
+    }
+    eb_write_block(address, buffer + offset, size);
+    check_memory("eb_write_block", address, size, offset);
+}
+
+static void test_memset(uint16_t address, size_t size) {
+    fill_memory();
+    for (size_t i = 0; i < size; i++) {
+        expected[address + i] = (expected[address + i] & 0xFF00) | 0x5A;
+    }
+    eb_memset(address, 0x5A, size);
+    check_memory("eb_memset", address, size, 0);
+}
+
+static void test_block(uint16_t address, size_t size) {
+    for (int offset = 0; offset < 4; offset++) {
+        test_read(address, size, offset);
+        test_write(address, size, offset);
+    }
+    test_memset(address, size);
+}
+
+int main() {
+    int tests = 0;
+    for (int parity = 0; parity < 2; parity++) {
+        for (size_t size = 0; size < MAX_LENGTH; size++) {
+            test_block(BASE + parity, size);
+            tests++;
+        }
+        test_block(BASE + parity, LONG_RUN);
+        tests++;
+    }
+    // up to the top of memory
+    test_block(EB_ADDRESS_HIGH - LONG_RUN, LONG_RUN);
+    tests++;
+    printf(PACK4_PATH " _eb_pack4(), %d blocks, %d failures\n", tests,
+           failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+/*
+
+Host test of reading the ring of bus write events, see ../eb_event_ring.h
+
+The DMA is simulated by writing each event's number and then its address
+into the rings. Checks that events are read in order, that when the reader
+falls more than a ring behind the lost events are counted and the drop
+handler is called with their number before the oldest left are read, and
+that over random bursts every event is either read or counted as dropped.
+
+    cmake -S render_util -B build
+    cmake --build build
+    ctest --test-dir build -R event_ring
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../eb_event_ring.h"
+
+// as atom_if.c with EB_EVENT_QUEUE_BITS=10
+#define LEN 256
+#define BURSTS 10000
+
+static volatile uint32_t queue[LEN];
+static volatile uint32_t seq[LEN];
+static uint32_t produced;  // events written by the simulated DMA
+static struct eb_event_reader reader;
+
+static int drop_calls;
+static uint32_t drop_total;
+static uint32_t last_dropped;
+
+static int failures;
+
+static void on_drop(uint32_t dropped) {
+    drop_calls++;
+    drop_total += dropped;
+    last_dropped = dropped;
+}
+
+static uint32_t write_index(void) { return produced; }
+
+/// @brief an event's address, different for each event number
+static uint32_t event_address(uint32_t n) {
+    return 0x10000 + (n * 37) % 0xF000;
+}
+
+static void produce(uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t at = produced % LEN;
+        seq[at] = produced;
+        queue[at] = event_address(produced);
+        produced++;
+    }
+}
+
+static int get(void) {
+    return _eb_ring_get(queue, seq, LEN, &reader, write_index);
+}
+
+static void reset(void) {
+    _eb_ring_init(seq, LEN, &reader);
+    reader.stats = (struct eb_event_stats){0};
+    reader.on_drop = on_drop;
+    produced = 0;
+    drop_calls = 0;
+    drop_total = 0;
+    last_dropped = 0;
+}
+
+static void check(bool ok, const char* test, const char* what) {
+    if (!ok) {
+        printf("%s: %s\n", test, what);
+        failures++;
+    }
+}
+
+/// @brief read the events from first to produced, in order
+static void expect_events(const char* test, uint32_t first) {
+    for (uint32_t n = first; n != produced; n++) {
+        const int event = get();
+        if (event != (int)event_address(n)) {
+            printf("%s: event %u is %x, not %x\n", test, (unsigned)n, event,
+                   (unsigned)event_address(n));
+            failures++;
+            return;
+        }
+    }
+    check(get() == -1, test, "events left after the last");
+}
+
+static void test_empty() {
+    reset();
+    check(get() == -1, "empty", "an event before any were written");
+    check(drop_calls == 0, "empty", "drop handler called");
+}
+
+static void test_in_order() {
+    reset();
+    produce(LEN);
+    expect_events("in order", 0);
+    check(drop_calls == 0, "in order", "drop handler called");
+    check(reader.stats.events == LEN, "in order", "events miscounted");
+    check(reader.stats.dropped == 0, "in order", "events dropped");
+    check(reader.stats.peak_depth == LEN, "in order", "peak depth wrong");
+}
+
+static void test_overrun() {
+    reset();
+    produce(3);
+    expect_events("overrun", 0);
+    // five more than the ring holds, the oldest five are overwritten
+    produce(LEN + 5);
+    expect_events("overrun", 3 + 5);
+    check(drop_calls == 1, "overrun", "drop handler not called once");
+    check(last_dropped == 5, "overrun", "drop handler not given 5");
+    check(reader.stats.dropped == 5, "overrun", "dropped miscounted");
+    check(reader.stats.events == 3 + LEN, "overrun", "events miscounted");
+    check(reader.stats.peak_depth == LEN + 5, "overrun", "peak depth wrong");
+}
+
+static void test_wrapped_count() {
+    // the event numbers wrap round while events are waiting
+    reset();
+    produced = reader.next_seq = UINT32_MAX - 10;
+    produce(20);
+    expect_events("wrapped count", UINT32_MAX - 10);
+    produce(2 * LEN);
+    expect_events("wrapped count", UINT32_MAX - 10 + 20 + LEN);
+    check(drop_total == LEN, "wrapped count", "drop handler not given a ring");
+}
+
+static void test_random_bursts() {
+    reset();
+    uint32_t random_state = 1;
+    uint32_t read = 0;
+    for (int i = 0; i < BURSTS; i++) {
+        random_state = random_state * 1103515245 + 12345;
+        produce((random_state >> 16) % (2 * LEN));
+        random_state = random_state * 1103515245 + 12345;
+        for (uint32_t n = (random_state >> 16) % (2 * LEN); n > 0; n--) {
+            if (get() == -1) {
+                break;
+            }
+            read++;
+        }
+    }
+    while (get() != -1) {
+        read++;
+    }
+    check(read == reader.stats.events, "random bursts", "events miscounted");
+    check(read + reader.stats.dropped == produced, "random bursts",
+          "events neither read nor dropped");
+    check(drop_total == reader.stats.dropped, "random bursts",
+          "drop handler not told of every event dropped");
+    check(drop_calls > 0, "random bursts", "no bursts overran the ring");
+}
+
+int main() {
+    test_empty();
+    test_in_order();
+    test_overrun();
+    test_wrapped_count();
+    test_random_bursts();
+    printf("event ring, %d failures\n", failures);
+    return failures ? 1 : 0;
+}
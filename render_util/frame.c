@@ -0,0 +1,113 @@
+/*
+
+Drawing whole frames with the firmware's renderers on a host computer
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "frame.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../colours.h"
+#include "../hstx_line.h"
+#include "../mc6847.h"
+#include "../platform.h"
+#include "../teletext.h"
+#include "hstx_decode.h"
+
+pixel_t frame[MODE_V_MAX_LINES][MODE_H_MAX_PIXELS];
+
+static uint32_t cmds[MODE_V_MAX_LINES][LINE_BUFFER_WORDS];
+static uint32_t cmd_words[MODE_V_MAX_LINES];
+
+void draw_frame(enum frame_type type, int mode) {
+    for (int line = 0; line < MODE_V_ACTIVE_LINES; line++) {
+        uint32_t* c = cmds[line];
+        switch (type) {
+            case FRAME_6847:
+                cmd_words[line] = draw_line(line, mode, FB_ADDR, c);
+                break;
+            // as the firmware's paint_vga80() and render_teletext()
+            case FRAME_VGA80:
+                if (line >= 40 * 12) {
+                    cmd_words[line] = line_solid(c, AT_BLACK);
+                    break;
+                }
+                do_text_vga80(line, line_pixels(c));
+                cmd_words[line] = line_finish(c, 0, 640, AT_BLACK);
+                break;
+            default:
+                do_teletext(line_pixels(c), MODE_H_ACTIVE_PIXELS, line, mode);
+                cmd_words[line] =
+                    line_finish(c, 0, MODE_H_ACTIVE_PIXELS, AT_BLACK);
+                break;
+        }
+    }
+}
+
+bool expand_frame(const char* name) {
+    for (int line = 0; line < MODE_V_ACTIVE_LINES; line++) {
+        pixel_t* p = frame[line];
+        if (!cmd_words[line]) {
+            memcpy(p, frame[line - 1], MODE_H_ACTIVE_PIXELS);
+            continue;
+        }
+        const char* error = hstx_decode(cmds[line], cmd_words[line], p);
+        if (error) {
+            fprintf(stderr, "%s line %d: %s\n", name, line, error);
+            return false;
+        }
+    }
+    return true;
+}
+
+// FNV-1a
+uint32_t frame_checksum() {
+    uint32_t h = 2166136261u;
+    for (int line = 0; line < MODE_V_ACTIVE_LINES; line++) {
+        for (int x = 0; x < MODE_H_ACTIVE_PIXELS; x++) {
+            h = (h ^ frame[line][x]) * 16777619u;
+        }
+    }
+    return h;
+}
+
+bool write_ppm(const char* dir, const char* name) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s.ppm", dir, name);
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Could not open file %s for writing\n", path);
+        return false;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", MODE_H_ACTIVE_PIXELS, MODE_V_ACTIVE_LINES);
+    for (int line = 0; line < MODE_V_ACTIVE_LINES; line++) {
+        for (int x = 0; x < MODE_H_ACTIVE_PIXELS; x++) {
+            // RGB332
+            const pixel_t c = frame[line][x];
+            const uint8_t rgb[3] = {((c >> 5) & 7) * 255 / 7,
+                                    ((c >> 2) & 7) * 255 / 7,
+                                    (c & 3) * 255 / 3};
+            fwrite(rgb, 1, 3, f);
+        }
+    }
+    fclose(f);
+    return true;
+}
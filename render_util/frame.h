@@ -0,0 +1,51 @@
+/*
+
+Drawing whole frames with the firmware's renderers on a host computer
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../videomode.h"
+
+enum frame_type { FRAME_6847, FRAME_VGA80, FRAME_TELETEXT };
+
+// the pixels of the last frame expanded, as RGB332
+extern pixel_t frame[MODE_V_MAX_LINES][MODE_H_MAX_PIXELS];
+
+/// @brief draw the HSTX commands for every line of a frame, as the firmware's
+/// renderer for the type would
+/// @param type the renderer
+/// @param mode the 6847 mode, or for teletext the flags register
+void draw_frame(enum frame_type type, int mode);
+
+/// @brief expand the commands of the last frame drawn into frame
+/// @param name printed with any error
+/// @return false if a line's HSTX commands were bad
+bool expand_frame(const char* name);
+
+/// @brief get a checksum of the expanded frame
+uint32_t frame_checksum(void);
+
+/// @brief write the expanded frame to dir/name.ppm
+/// @return false if the file could not be written
+bool write_ppm(const char* dir, const char* name);
@@ -0,0 +1,199 @@
+/*
+
+Host simulation of the frame genlock in ../genlock.c
+
+The Atom's frames are given a clock offset from the output frames and the
+edges of FS are seen on whole lines, as the DMA IRQ sees them. For each
+offset prints how many frames it took to lock and the range of the error
+once locked.
+
+    cmake -S render_util -B build -DMODE=MODE_640x480_60_FAST
+    cmake --build build
+    build/genlock_sim
+    build/genlock_sim -o 6700 -j 1
+
+Exits with 1 if an offset within range of GENLOCK_MAX_LINES did not lock or
+lost its lock.
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../genlock.h"
+#include "../videomode.h"
+
+// as dvi_out_hstx_encoder_mod.c
+#define SYNC_LINES (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH)
+#define BLANK_LINES (SYNC_LINES + MODE_V_BACK_PORCH)
+#define TOTAL_LINES (BLANK_LINES + MODE_V_ACTIVE_LINES)
+#define FS_SETPOINT (BLANK_LINES + (MODE_V_ACTIVE_LINES + 192 * YSCALE) / 2 - 1)
+
+struct result {
+    int lock_frame;  // -1 if it never locked
+    int min_error;   // once locked
+    int max_error;
+    double mean_adjust;
+    uint32_t lock_losses;
+};
+
+/// @brief the line the IRQ sees an edge on
+/// @param t lines since the start of the frame's vertical blanking
+/// @param adjust lines added to the frame's back porch
+static int seen_line(double t, int adjust) {
+    if (t < SYNC_LINES) {
+        // at the end of the front porch and sync lines
+        return SYNC_LINES;
+    }
+    if (t < BLANK_LINES + adjust) {
+        // at the end of the back porch, whose extra lines are not counted
+        return BLANK_LINES;
+    }
+    // each active line's IRQ sets up the line after
+    return (int)floor(t - adjust) + 1;
+}
+
+/// @brief run the loop against Atom frames with a clock offset
+/// @param ppm how much faster the Atom's clock is, in parts per million
+/// @param jitter most lines an edge can be seen late by
+/// @param phase where the first Atom frame starts, in lines
+/// @param frames output frames to run for
+static struct result simulate(double ppm, double jitter, double phase,
+                              int frames) {
+    genlock_init(TOTAL_LINES, FS_SETPOINT);
+    // an Atom frame in output lines
+    const double period = TOTAL_LINES / (1 + ppm / 1e6);
+    // the edge is where the 6847 picture ends, so lined up with the setpoint
+    // when phase is 0
+    double edge = phase + FS_SETPOINT;
+    double start = 0;
+    int adjust = 0;
+    long adjust_sum = 0;
+    int adjust_frames = 0;
+    struct result r = {.lock_frame = -1, .min_error = TOTAL_LINES,
+                       .max_error = -TOTAL_LINES};
+    for (int frame = 0; frame < frames; frame++) {
+        const double end = start + TOTAL_LINES + adjust;
+        int line = -1;
+        while (edge < end) {
+            const double seen =
+                edge + jitter * rand() / ((double)RAND_MAX + 1);
+            if (edge >= start) {
+                // the handler keeps the last edge of the frame
+                line = seen_line(seen - start, adjust);
+            }
+            edge += period;
+        }
+        start = end;
+        adjust = genlock_frame(line);
+
+        struct genlock_stats s;
+        genlock_get_stats(&s);
+        if (s.locked && r.lock_frame < 0) {
+            r.lock_frame = frame;
+        }
+        if (r.lock_frame >= 0) {
+            if (s.error < r.min_error) {
+                r.min_error = s.error;
+            }
+            if (s.error > r.max_error) {
+                r.max_error = s.error;
+            }
+            adjust_sum += adjust;
+            adjust_frames++;
+        }
+        r.lock_losses = s.lock_losses;
+    }
+    r.mean_adjust = adjust_frames ? (double)adjust_sum / adjust_frames : 0;
+    return r;
+}
+
+/// @brief run and print one offset
+/// @return false if it should have locked and did not, or lost its lock
+static bool run(double ppm, double jitter, double phase, int frames) {
+    const struct result r = simulate(ppm, jitter, phase, frames);
+    // lines a frame the Atom's frames are shorter by
+    const double lines = TOTAL_LINES * ppm / (1e6 + ppm);
+    // leave a line of margin for the jitter and the whole line steps, and
+    // the lock is only kept if the jitter fits inside GENLOCK_LOCK_LINES
+    const bool in_range = fabs(lines) + jitter + 1 <= GENLOCK_MAX_LINES &&
+                          jitter + 1 <= GENLOCK_LOCK_LINES;
+    printf("%8.0f ppm %6.2f lines/frame  ", ppm, lines);
+    if (r.lock_frame < 0) {
+        printf("not locked%s\n", in_range ? "  FAIL" : "");
+        return !in_range;
+    }
+    printf("locked at frame %4d, error %d to %d, mean adjust %5.2f, lost %u",
+           r.lock_frame, r.min_error, r.max_error, r.mean_adjust,
+           (unsigned)r.lock_losses);
+    const bool good = !in_range || r.lock_losses == 0;
+    printf("%s\n", good ? "" : "  FAIL");
+    return good;
+}
+
+int main(int argc, char** argv) {
+    video_mode_select(MODE);
+    double jitter = 0;
+    double phase = TOTAL_LINES / 2.0;
+    int frames = 3000;
+    bool one = false;
+    double ppm = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:j:p:n:")) != -1) {
+        switch (opt) {
+            case 'o':
+                ppm = atof(optarg);
+                one = true;
+                break;
+            case 'j':
+                jitter = atof(optarg);
+                break;
+            case 'p':
+                phase = atof(optarg);
+                break;
+            case 'n':
+                frames = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr,
+                        "usage: %s [-o clock offset ppm] [-j jitter lines] "
+                        "[-p starting phase lines] [-n frames]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+
+    printf("%d lines, setpoint %d, at most %d lines a frame\n", TOTAL_LINES,
+           FS_SETPOINT, GENLOCK_MAX_LINES);
+    if (one) {
+        return run(ppm, jitter, phase, frames) ? 0 : 1;
+    }
+    // the Atom against MODE_640x480_60_FAST is about 6700 ppm
+    static const double offsets[] = {0,     100,    -100,   1000,  -1000,
+                                     6700,  -6700,  12000,  -12000, 20000,
+                                     -20000};
+    bool good = true;
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        good &= run(offsets[i], jitter, phase, frames);
+    }
+    return good ? 0 : 1;
+}
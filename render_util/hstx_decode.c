@@ -0,0 +1,133 @@
+/*
+
+Check and expand the HSTX command lists made for display lines
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "hstx_decode.h"
+
+#include <stddef.h>
+
+#include "../hstx_line.h"
+
+// Pixels are encoded 4 to a word, the first in the low byte. With
+// NATIVE_SCANOUT the HSTX takes only the low 2, with PACKED_PIXELS there
+// are 8 to a word, the first in the low nibble.
+#if NATIVE_SCANOUT
+#define WORD_PIXELS 2
+#else
+#define WORD_PIXELS PIXELS_PER_WORD
+#endif
+
+static inline pixel_t word_pixel(uint32_t word, uint32_t i) {
+#if PACKED_PIXELS
+    return unpack_colour((word >> (4 * (i % WORD_PIXELS))) & 0xf);
+#else
+    return word >> (8 * (i % WORD_PIXELS));
+#endif
+}
+
+const char* hstx_decode(const uint32_t* cmds, uint32_t words, pixel_t* p) {
+#if NATIVE_SCANOUT
+    // The words the HSTX sees are the commands and then a word for each
+    // transfer of pixels, the byte or halfword replicated across it
+    uint32_t stream[LINE_BUFFER_WORDS + MODE_H_MAX_PIXELS / 2];
+    const bool doubled = words & LINE_DOUBLED;
+    words &= LINE_WORDS_MASK;
+    if (words == 0 || words > LINE_BUFFER_WORDS) {
+        return "list longer than a line buffer";
+    }
+    if ((cmds[words - 1] & HSTX_CMD_MASK) != HSTX_CMD_TMDS) {
+        return "commands do not end with the pixels";
+    }
+    const uint32_t transfers = (cmds[words - 1] & HSTX_COUNT_MASK) / 2;
+    if (words + (transfers * (doubled ? 1 : 2) + 3) / 4 > LINE_BUFFER_WORDS) {
+        return "pixels run past the end of the line buffer";
+    }
+    const uint8_t* b = (const uint8_t*)(cmds + words);
+    for (uint32_t i = 0; i < words; i++) {
+        stream[i] = cmds[i];
+    }
+    for (uint32_t i = 0; i < transfers; i++) {
+        stream[words + i] = doubled ? b[i] * 0x01010101u
+                                    : (b[2 * i] | b[2 * i + 1] << 8) * 0x10001u;
+    }
+    cmds = stream;
+    words += transfers;
+#else
+    if (words > LINE_BUFFER_WORDS) {
+        return "list longer than a line buffer";
+    }
+#endif
+    const uint32_t* end = cmds + words;
+    uint32_t blanking = 0;
+    uint32_t x = 0;
+    while (cmds < end) {
+        const uint32_t cmd = *cmds & HSTX_CMD_MASK;
+        const uint32_t count = *cmds & HSTX_COUNT_MASK;
+        if (*cmds++ >> 16) {
+            return "command with high bits set";
+        }
+        uint32_t data_words;
+        switch (cmd) {
+            case HSTX_CMD_NOP:
+                continue;
+            case HSTX_CMD_RAW:
+            case HSTX_CMD_RAW_REPEAT:
+                // the horizontal blanking, one symbol per pixel clock
+                if (x) {
+                    return "raw symbols among the pixels";
+                }
+                blanking += count;
+                data_words = cmd == HSTX_CMD_RAW ? count : 1;
+                break;
+            case HSTX_CMD_TMDS:
+            case HSTX_CMD_TMDS_REPEAT:
+                if (blanking != MODE_H_FRONT_PORCH + MODE_H_SYNC_WIDTH +
+                                    MODE_H_BACK_PORCH) {
+                    return "horizontal blanking is the wrong length";
+                }
+                if (count % PIXELS_PER_WORD) {
+                    return "pixel count that is not a whole number of words";
+                }
+                if (x + count > MODE_H_ACTIVE_PIXELS) {
+                    return "too many pixels";
+                }
+                data_words = cmd == HSTX_CMD_TMDS ? count / WORD_PIXELS : 1;
+                break;
+            default:
+                return "unknown command";
+        }
+        if (cmds + data_words > end) {
+            return "list ends in the middle of a command";
+        }
+        if (cmd == HSTX_CMD_TMDS || cmd == HSTX_CMD_TMDS_REPEAT) {
+            for (uint32_t i = 0; i < count; i++) {
+                const uint32_t word =
+                    cmd == HSTX_CMD_TMDS ? cmds[i / WORD_PIXELS] : cmds[0];
+                p[x++] = word_pixel(word, i);
+            }
+        }
+        cmds += data_words;
+    }
+    if (x != MODE_H_ACTIVE_PIXELS) {
+        return "too few pixels";
+    }
+    return NULL;
+}
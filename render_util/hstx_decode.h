@@ -0,0 +1,38 @@
+/*
+
+Check and expand the HSTX command lists made for display lines
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../videomode.h"
+
+/// @brief expand the list of commands for an active line into pixels, as
+/// the HSTX would, checking its horizontal blanking on the way
+/// @param cmds the list
+/// @param words the number of words in the list, or with NATIVE_SCANOUT
+/// the number of command words and LINE_DOUBLED
+/// @param p filled in with MODE_H_ACTIVE_PIXELS pixels, as RGB332 even with
+/// PACKED_PIXELS
+/// @return NULL if the list is good, otherwise what is wrong with it
+const char* hstx_decode(const uint32_t* cmds, uint32_t words, pixel_t* p);
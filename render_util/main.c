@@ -0,0 +1,423 @@
+/*
+
+Utility for checking and timing the display renderers on a host computer.
+
+Renders every 6847 mode, both VGA80 variants and some teletext pages from
+fixed video memory contents. Prints a checksum of each frame and the time
+taken to render a line. The frames can also be written out as PPM files.
+
+    cmake -S render_util -B build -DMODE=MODE_640x480_60_FAST
+    cmake --build build
+    build/render -o ppm_dir -n 100
+    ctest --test-dir build
+
+-g compares the checksums with a file of them made by an earlier run,
+exiting with 1 if any differ. render_util/golden has a file for each video
+mode and build option, which ctest checks against. When a change to the
+drawing is meant to change the frames, make the files again with
+    build/render -n 0 -m 4 > render_util/golden/MODE_640x480_60_FAST.txt
+and so on, and look at the frames with -o before committing them.
+-c prints the colours the HSTX sends for the palette, which are approximate
+with PACKED_PIXELS. -m renders in another of the video modes the build can
+choose at boot, by its MODE_ number.
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../atom_if.h"
+#include "../colours.h"
+#include "../hstx_line.h"
+#include "../mc6847.h"
+#include "../platform.h"
+#include "../teletext.h"
+#include "../videomode.h"
+#include "frame.h"
+
+// The bus interface is not emulated, video memory is filled in directly
+volatile uint16_t _eb_memory[EB_BUFFER_LENGTH];
+uint eb_event_chan;
+
+void eb_init(PIO pio) {}
+
+int eb_get_event() { return -1; }
+
+void eb_set_drop_handler(eb_drop_handler_t handler) {}
+
+// from mc6847.c
+extern volatile uint8_t artifact;
+
+#define COL80_OFF 0x00
+#define COL80_ON 0x80
+#define COL80_ATTR 0x08
+
+#define MAX_IMAGES 64
+
+struct image {
+    char name[32];
+    enum frame_type type;
+    int mode;      // 6847 mode, VGA80 attributes on or teletext page
+    bool alt;      // alternative colour set
+    int artifact;  // artifact colours
+};
+
+// A fixed generator, so that the video memory, and so the checksums, are the
+// same whatever the C library
+static uint32_t random_state;
+
+static uint8_t next_random() {
+    random_state = random_state * 1103515245 + 12345;
+    return random_state >> 16;
+}
+
+static void fill_random(uint16_t address, size_t size, uint32_t seed) {
+    random_state = seed;
+    for (size_t i = 0; i < size; i++) {
+        eb_set(address + i, next_random());
+    }
+}
+
+/// @brief write one of the teletext test pages
+/// @param page 0 for text, 1 for graphics, 2 for double height
+static void teletext_page(int page) {
+    char str[TELETEXT_COLUMNS + 1];
+    for (int row = 0; row < TELETEXT_ROWS; row++) {
+        memset(str, 0, sizeof(str));
+        const int colour = 1 + row % 7;
+        switch (page) {
+            case 0:
+                // every character in every colour, with some backgrounds
+                str[0] = ALPHA_RED + (colour % 7);
+                str[1] = (row & 4) ? NEW_BACKGROUND : ' ';
+                str[2] = ALPHA_RED + (colour - 1);
+                for (int col = 3; col < TELETEXT_COLUMNS; col++) {
+                    str[col] = 0x20 + (row * 37 + col) % 0x60;
+                }
+                str[20] = (row & 1) ? FLASH : STEADY;
+                str[30] = (row & 2) ? CONCEAL_DISPLAY : ' ';
+                break;
+            case 1:
+                // contiguous, separated and held graphics
+                str[0] = GRAPHICS_RED + (colour - 1);
+                str[1] = (row & 1) ? SEPARATED_GRAPHICS : CONTIGUOUS_GRAPHICS;
+                str[2] = (row & 2) ? HOLD_GRAPHICS : RELEASE_GRAPHICS;
+                for (int col = 3; col < TELETEXT_COLUMNS; col++) {
+                    str[col] = 0x20 + (row * 41 + col) % 0x60;
+                }
+                str[12] = GRAPHICS_RED + colour % 7;
+                str[24] = ALPHA_WHITE;
+                str[28] = GRAPHICS_BLUE;
+                break;
+            default:
+                // double height text and graphics on alternate rows
+                str[0] = (row & 2) ? GRAPHICS_RED + (colour - 1)
+                                   : ALPHA_RED + (colour - 1);
+                str[1] = (row & 1) ? NORMAL_HEIGHT : DOUBLE_HEIGHT;
+                for (int col = 2; col < TELETEXT_COLUMNS; col++) {
+                    str[col] = 0x20 + (row * 13 + col) % 0x60;
+                }
+                break;
+        }
+        // copied a byte at a time as str is not a C string
+        const uint16_t address =
+            TELETEXT_PAGE_BUFFER + row * TELETEXT_COLUMNS;
+        eb_memset(address, ' ', TELETEXT_COLUMNS);
+        for (int col = 0; col < TELETEXT_COLUMNS; col++) {
+            if (str[col]) {
+                eb_set(address + col, str[col]);
+            }
+        }
+    }
+}
+
+static void setup_image(const struct image* image) {
+    eb_set(COL80_BASE, COL80_OFF);
+    artifact = image->artifact;
+    switch (image->type) {
+        case FRAME_6847:
+            fill_random(FB_ADDR, 0x1800, 6847);
+            eb_set(PIA_ADDR, image->mode << 4);
+            eb_set(PIA_ADDR + 2, image->alt ? 0x08 : 0x00);
+            break;
+        case FRAME_VGA80:
+            fill_random(FB_ADDR, 80 * 40 * 2, 80);
+            eb_set(COL80_BASE, COL80_ON);
+            eb_set(COL80_FG, image->mode ? 0xB2 | COL80_ATTR : 0xB2);
+            eb_set(COL80_BG, 0x04);
+            break;
+        case FRAME_TELETEXT:
+            teletext_page(image->mode);
+            break;
+    }
+    mc6847_invalidate();
+    mc6847_mode_write();
+}
+
+/// @brief print the colour the HSTX sends for each colour of the palettes,
+/// which differs from the RGB332 colour with PACKED_PIXELS
+/// @return false if two colours look the same on the screen
+static bool check_colours() {
+    static const struct {
+        const char* name;
+        pixel_t colour;
+    } colours[] = {
+        {"black", AT_BLACK},     {"red", AT_RED},   {"green", AT_GREEN},
+        {"yellow", AT_YELLOW},   {"blue", AT_BLUE}, {"magenta", AT_MAGENTA},
+        {"cyan", AT_CYAN},       {"white", AT_WHITE},
+        {"orange", AT_ORANGE},
+#if INCLUDE_BRIGHT_ORANGE
+        {"bright orange", BRIGHT_ORANGE},
+#endif
+    };
+    bool good = true;
+    printf("colour         RGB332  sent  R  G  B (TMDS levels, error)\n");
+    for (size_t i = 0; i < count_of(colours); i++) {
+        const pixel_t c = colours[i].colour;
+        const pixel_t sent = unpack_colour(pack_colour(c));
+        // the byte each lane encodes
+        const int want[3] = {c & 0xe0, (c << 3) & 0xe0, (c << 6) & 0xc0};
+        const int got[3] = {sent & 0xe0, (sent << 3) & 0xe0,
+                            (sent << 6) & 0xc0};
+        printf("%-14s %02x      %02x   ", colours[i].name, c, sent);
+        for (int lane = 0; lane < 3; lane++) {
+            printf(" %02x(%+4d)", got[lane], got[lane] - want[lane]);
+        }
+        printf("\n");
+        for (size_t j = 0; j < i; j++) {
+            if (unpack_colour(pack_colour(colours[j].colour)) == sent) {
+                printf("%s looks the same as %s\n", colours[i].name,
+                       colours[j].name);
+                good = false;
+            }
+        }
+    }
+    return good;
+}
+
+static void draw_image(const struct image* image) {
+    // the teletext pages are drawn without any flags
+    draw_frame(image->type, image->type == FRAME_TELETEXT ? 0 : image->mode);
+}
+
+/// @brief compare the checksums with those in a file
+/// @param name the file, lines of image name and checksum as printed by
+/// main(), other lines and those starting with # are skipped
+/// @return false if any are different or missing, or the file cannot be read
+static bool check_golden(const char* name, const struct image* images,
+                         const uint32_t* checksums, int count) {
+    FILE* f = fopen(name, "r");
+    if (!f) {
+        fprintf(stderr, "Could not open %s\n", name);
+        return false;
+    }
+    bool found[MAX_IMAGES] = {false};
+    bool good = true;
+    char line[80];
+    while (fgets(line, sizeof(line), f)) {
+        char image[32];
+        unsigned checksum;
+        if (line[0] == '#' ||
+            sscanf(line, "%31s %x", image, &checksum) != 2) {
+            continue;
+        }
+        int i = 0;
+        while (i < count && strcmp(images[i].name, image)) {
+            i++;
+        }
+        if (i == count) {
+            printf("%s is in %s but was not drawn\n", image, name);
+            good = false;
+        } else {
+            found[i] = true;
+            if (checksums[i] != checksum) {
+                printf("%s is %08x, %s has %08x\n", image, checksums[i], name,
+                       checksum);
+                good = false;
+            }
+        }
+    }
+    fclose(f);
+    for (int i = 0; i < count; i++) {
+        if (!found[i]) {
+            printf("%s is not in %s\n", images[i].name, name);
+            good = false;
+        }
+    }
+    printf("%s %s\n", name, good ? "matches" : "does not match");
+    return good;
+}
+
+/// @brief check that a 6847 frame drawn after writes to video memory, with
+/// the line cache kept, is the same as one drawn with it emptied
+/// @return false if they differ
+static bool check_line_cache(const struct image* image) {
+    setup_image(image);
+    draw_image(image);
+    // a byte in every 16, without telling the cache
+    random_state = 1;
+    for (int i = 0; i < 0x1800; i += 16) {
+        eb_set(FB_ADDR + i + next_random() % 16, next_random());
+    }
+    draw_image(image);
+    expand_frame(image->name);
+    const uint32_t cached = frame_checksum();
+    mc6847_invalidate();
+    draw_image(image);
+    expand_frame(image->name);
+    if (frame_checksum() != cached) {
+        printf("%s differs when drawn with the line cache\n", image->name);
+        return false;
+    }
+    return true;
+}
+
+/// @brief time the drawing of a number of frames
+/// @return the mean time to draw a line in ns
+static double time_frames(const struct image* image, int frames) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < frames; i++) {
+        // measure drawing rather than copying from the line cache
+        mc6847_invalidate();
+        draw_image(image);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double ns = (end.tv_sec - start.tv_sec) * 1e9 +
+                      (end.tv_nsec - start.tv_nsec);
+    return ns / ((double)frames * MODE_V_ACTIVE_LINES);
+}
+
+static int get_images(struct image* images) {
+    int n = 0;
+    for (int mode = 0; mode < 16; mode++) {
+        for (int alt = 0; alt < 2; alt++) {
+            images[n] = (struct image){.type = FRAME_6847, .mode = mode,
+                                       .alt = alt};
+            snprintf(images[n].name, sizeof(images[n].name),
+                     "6847_mode%02d_css%d", mode, alt);
+            n++;
+        }
+    }
+    for (int a = 1; a <= 2; a++) {
+        images[n] = (struct image){.type = FRAME_6847, .mode = 15,
+                                   .artifact = a};
+        snprintf(images[n].name, sizeof(images[n].name),
+                 "6847_mode15_artifact%d", a);
+        n++;
+    }
+    for (int attr = 0; attr < 2; attr++) {
+        images[n] = (struct image){.type = FRAME_VGA80, .mode = attr};
+        snprintf(images[n].name, sizeof(images[n].name), "vga80_attr%d",
+                 attr);
+        n++;
+    }
+    for (int page = 0; page < 3; page++) {
+        images[n] = (struct image){.type = FRAME_TELETEXT, .mode = page};
+        snprintf(images[n].name, sizeof(images[n].name), "teletext_page%d",
+                 page);
+        n++;
+    }
+    return n;
+}
+
+int main(int argc, char** argv) {
+    const char* dir = NULL;
+    const char* golden = NULL;
+    int frames = 100;
+    int mode = MODE;
+    int opt;
+    while ((opt = getopt(argc, argv, "cg:o:n:m:")) != -1) {
+        switch (opt) {
+            case 'c':
+                return check_colours() ? 0 : 1;
+            case 'g':
+                golden = optarg;
+                break;
+            case 'm':
+                mode = atoi(optarg);
+                break;
+            case 'o':
+                dir = optarg;
+                break;
+            case 'n':
+                frames = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr,
+                        "usage: %s [-c] [-g golden checksums] [-o ppm "
+                        "directory] [-n frames to time] [-m video mode]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+
+    if (!video_mode_select(mode)) {
+        fprintf(stderr, "mode %d cannot be used by this build\n", mode);
+        return 2;
+    }
+    mc6847_init(true, false, false);
+
+    struct image images[MAX_IMAGES];
+    const int count = get_images(images);
+    uint32_t checksums[MAX_IMAGES];
+
+    // All the frames are drawn before any are timed so that the checksums
+    // do not depend on the number of frames timed. Teletext flashes as
+    // frames are drawn.
+    for (int i = 0; i < count; i++) {
+        setup_image(&images[i]);
+        // the second frame, so that anything carried from one frame to the
+        // next has settled
+        draw_image(&images[i]);
+        draw_image(&images[i]);
+        if (!expand_frame(images[i].name)) {
+            return 1;
+        }
+        checksums[i] = frame_checksum();
+        if (dir && !write_ppm(dir, images[i].name)) {
+            return 1;
+        }
+    }
+
+    printf("%dx%d\n", MODE_H_ACTIVE_PIXELS, MODE_V_ACTIVE_LINES);
+    for (int i = 0; i < count; i++) {
+        printf("%-24s %08x", images[i].name, checksums[i]);
+        if (frames > 0) {
+            setup_image(&images[i]);
+            printf(" %8.1f ns/line", time_frames(&images[i], frames));
+        }
+        printf("\n");
+    }
+    bool good = true;
+    for (int i = 0; i < count; i++) {
+        if (images[i].type == FRAME_6847) {
+            good &= check_line_cache(&images[i]);
+        }
+    }
+    if (golden) {
+        good &= check_golden(golden, images, checksums, count);
+    }
+    return good ? 0 : 1;
+}
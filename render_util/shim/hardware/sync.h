@@ -0,0 +1,5 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+#define __dmb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
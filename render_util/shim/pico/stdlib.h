@@ -0,0 +1,57 @@
+/*
+
+Just enough of the pico SDK to build the renderers on a host
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+typedef unsigned int uint;
+
+#define hard_assert(x) assert(x)
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+#define __not_in_flash_func(f) f
+#define __no_inline_not_in_flash_func(f) f
+#define __time_critical_func(f) f
+
+// The bus interface is never started on the host
+typedef struct pio_hw* PIO;
+#define pio0 ((PIO)0)
+#define pio1 ((PIO)1)
+typedef void (*irq_handler_t)(void);
+
+static inline void gpio_put(uint gpio, bool value) {}
+
+// not when the headers are only compiled for the RP2350, see eb_block_arm.c
+#ifdef CLOCK_MONOTONIC
+static inline uint64_t time_us_64() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint32_t time_us_32() { return (uint32_t)time_us_64(); }
+#endif
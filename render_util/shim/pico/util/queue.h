@@ -0,0 +1,73 @@
+/*
+
+A single threaded queue_t for building the renderers on a host
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#define QUEUE_BYTES 256
+
+typedef struct {
+    uint element_size;
+    uint element_count;
+    uint head;
+    uint count;
+    uint8_t data[QUEUE_BYTES];
+} queue_t;
+
+static inline void queue_init(queue_t* q, uint element_size,
+                              uint element_count) {
+    assert(element_size * element_count <= QUEUE_BYTES);
+    q->element_size = element_size;
+    q->element_count = element_count;
+    q->head = 0;
+    q->count = 0;
+}
+
+static inline bool queue_try_add(queue_t* q, const void* data) {
+    if (q->count == q->element_count) {
+        return false;
+    }
+    const uint i = (q->head + q->count) % q->element_count;
+    memcpy(q->data + i * q->element_size, data, q->element_size);
+    q->count++;
+    return true;
+}
+
+static inline bool queue_try_remove(queue_t* q, void* data) {
+    if (q->count == 0) {
+        return false;
+    }
+    memcpy(data, q->data + q->head * q->element_size, q->element_size);
+    q->head = (q->head + 1) % q->element_count;
+    q->count--;
+    return true;
+}
+
+// nothing else can add to the queue, so an empty queue never fills
+static inline void queue_remove_blocking(queue_t* q, void* data) {
+    while (!queue_try_remove(q, data)) {
+        assert(false);
+    }
+}
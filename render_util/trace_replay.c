@@ -0,0 +1,301 @@
+/*
+
+Plays back a trace of 6502 writes recorded with BUS_TRACE, see ../trace.h
+
+The memory saved at the start of the trace is loaded and the writes are
+made in order, each dispatched to the handlers the firmware registers. The
+display is drawn with the firmware's renderers at each frame of the trace's
+video mode and the SID writes are played through the firmware's reSID set
+up. For each frame prints the writes made during it, the renderer used, the
+time taken to draw a line and a checksum of the frame.
+
+    cmake -S render_util -B build -DMODE=MODE_640x480_60_FAST
+    cmake --build build
+    build/trace_replay trc0001.bin
+    build/trace_replay -o ppm_dir -w sid.wav -f 100 trc0001.bin
+
+-o writes each frame as a PPM file and -w the SID's output as a WAV file.
+-f stops after that many frames. The build must be able to use the trace's
+video mode, -m picks another one by its MODE_ number.
+
+The time and value of each write are those when the firmware handled it,
+not when the 6502 made it, see the limitation described in ../trace.h. A
+warning saying so is printed before the frames.
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../atom_if.h"
+#include "../atom_sid.h"
+#include "../eb_handlers.h"
+#include "../mc6847.h"
+#include "../platform.h"
+#include "../sid_emu.h"
+#include "../teletext.h"
+#include "../trace.h"
+#include "../videomode.h"
+#include "frame.h"
+
+// The bus interface is not emulated, the writes are made directly
+volatile uint16_t _eb_memory[EB_BUFFER_LENGTH];
+uint eb_event_chan;
+
+void eb_init(PIO pio) {}
+
+int eb_get_event() { return -1; }
+
+void eb_set_drop_handler(eb_drop_handler_t handler) {}
+
+#define COL80_ON 0x80
+#define WAV_BITS 16
+
+static FILE* wav;
+static uint32_t wav_samples;
+static uint32_t sid_writes;
+
+/// @brief the SID handler, without the firmware's queue as the SID is run
+/// in step with the writes
+static void sid_write(uint16_t address, void* ctx) {
+    sid_emu_write(address & 0x1F, eb_get(address));
+    sid_writes++;
+}
+
+static void put_le(uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fputc(value >> (8 * i), wav);
+    }
+}
+
+static void write_wav_header() {
+    fseek(wav, 0, SEEK_SET);
+    fwrite("RIFF", 1, 4, wav);
+    put_le(36 + wav_samples * 2, 4);
+    fwrite("WAVEfmt ", 1, 8, wav);
+    put_le(16, 4);
+    put_le(1, 2);  // PCM
+    put_le(1, 2);  // mono
+    put_le(SID_EMU_SAMPLE_RATE, 4);
+    put_le(SID_EMU_SAMPLE_RATE * 2, 4);
+    put_le(2, 2);
+    put_le(WAV_BITS, 2);
+    fwrite("data", 1, 4, wav);
+    put_le(wav_samples * 2, 4);
+}
+
+/// @brief run the SID up to a time, as the firmware's sample tick does
+/// @param sid_us the time the SID has been run to
+/// @param time_us the time to run it to
+static void run_sid(uint32_t* sid_us, uint32_t time_us) {
+    while ((int32_t)(time_us - *sid_us) >= SID_EMU_TICK_US) {
+        const int sample = sid_emu_output(WAV_BITS);
+        if (wav) {
+            put_le((uint16_t)sample, 2);
+            wav_samples++;
+        }
+        sid_emu_clock();
+        *sid_us += SID_EMU_TICK_US;
+    }
+}
+
+/// @brief the renderer the firmware's select_renderer() would use
+static enum frame_type frame_type(bool teletext) {
+    if (eb_get(COL80_BASE) & COL80_ON) {
+        return FRAME_VGA80;
+    }
+    return teletext ? FRAME_TELETEXT : FRAME_6847;
+}
+
+static double now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/// @brief draw and report a frame
+/// @return false if the frame could not be drawn or saved
+static bool replay_frame(int number, uint32_t time_us, uint32_t writes,
+                         bool teletext, const char* dir) {
+    static const char* names[] = {"6847", "vga80", "teletext"};
+    const enum frame_type type = frame_type(teletext);
+    const int mode = type == FRAME_TELETEXT ? eb_get(TELETEXT_REG_FLAGS)
+                                            : get_mode();
+    const double start = now_ns();
+    draw_frame(type, mode);
+    const double ns = (now_ns() - start) / MODE_V_ACTIVE_LINES;
+
+    char name[32];
+    snprintf(name, sizeof(name), "frame%05d", number);
+    if (!expand_frame(name)) {
+        return false;
+    }
+    printf("%5d %9.3f ms %5u writes %4u sid  %-8s", number, time_us / 1e3,
+           (unsigned)writes, (unsigned)sid_writes, names[type]);
+    if (type == FRAME_6847) {
+        printf(" mode %2d", mode);
+    } else {
+        printf("        ");
+    }
+    printf(" %8.1f ns/line %08x\n", ns, frame_checksum());
+    sid_writes = 0;
+    return !dir || write_ppm(dir, name);
+}
+
+int main(int argc, char** argv) {
+    const char* dir = NULL;
+    const char* wav_name = NULL;
+    int mode = -1;
+    long max_frames = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:w:m:f:")) != -1) {
+        switch (opt) {
+            case 'o':
+                dir = optarg;
+                break;
+            case 'w':
+                wav_name = optarg;
+                break;
+            case 'm':
+                mode = atoi(optarg);
+                break;
+            case 'f':
+                max_frames = atol(optarg);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr,
+                "usage: %s [-o ppm directory] [-w wav file] [-m video mode] "
+                "[-f frames] trace\n",
+                argv[0]);
+        return 2;
+    }
+
+    FILE* f = fopen(argv[optind], "rb");
+    if (!f) {
+        fprintf(stderr, "Could not open %s\n", argv[optind]);
+        return 1;
+    }
+    struct trace_header header;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        header.magic != TRACE_MAGIC || header.version != TRACE_VERSION ||
+        header.header_size < sizeof(header)) {
+        fprintf(stderr, "%s is not a trace\n", argv[optind]);
+        return 1;
+    }
+    static uint8_t memory[EB_ADDRESS_HIGH];
+    if (fseek(f, header.header_size, SEEK_SET) ||
+        fread(memory, sizeof(memory), 1, f) != 1) {
+        fprintf(stderr, "%s is too short\n", argv[optind]);
+        return 1;
+    }
+    printf("%u records, %u dropped, %u events dropped\n",
+           (unsigned)header.records, (unsigned)header.dropped,
+           (unsigned)header.events_dropped);
+    // see the limitation in ../trace.h
+    printf("warning: each write's time and value are those when the firmware "
+           "handled it,\n"
+           "writes to an address handled together all show the last value\n");
+
+    if (mode < 0) {
+        mode = header.mode;
+    }
+    if (!video_mode_select(mode)) {
+        fprintf(stderr, "mode %d cannot be used by this build\n", mode);
+        return 2;
+    }
+    const bool teletext = header.teletext;
+    mc6847_init(true, false, teletext);
+    bool ok = sid_emu_init();
+    ok &= eb_register_write_handler(SID_BASE_ADDR, SID_WRITEABLE, sid_write,
+                                    NULL);
+    if (!ok) {
+        fprintf(stderr, "could not set up the SID\n");
+        return 1;
+    }
+    // after mc6847_init(), which sets up the 80 column registers
+    eb_write_block(0, memory, sizeof(memory));
+    mc6847_invalidate();
+    mc6847_mode_write();
+
+    if (wav_name) {
+        wav = fopen(wav_name, "wb");
+        if (!wav) {
+            fprintf(stderr, "Could not open file %s for writing\n", wav_name);
+            return 1;
+        }
+        write_wav_header();
+    }
+
+    const struct video_mode* m = &video_mode;
+    const double frame_us =
+        (double)(m->h_front_porch + m->h_sync_width + m->h_back_porch +
+                 m->h_active_pixels) *
+        (m->v_front_porch + m->v_sync_width + m->v_back_porch +
+         m->v_active_lines) *
+        5e3 / m->hstx_clk_khz;
+    printf("%s, %.1f us a frame\n", m->name, frame_us);
+
+    int frames = 0;
+    uint32_t writes = 0;
+    uint32_t sid_us = 0;
+    struct trace_record r;
+    bool good = true;
+    for (uint32_t i = 0; good && i < header.records; i++) {
+        if (fread(&r, sizeof(r), 1, f) != 1) {
+            fprintf(stderr, "the trace ends after %u records\n", (unsigned)i);
+            break;
+        }
+        // the frames that ended before this write
+        while (good && r.time_us >= (frames + 1) * frame_us &&
+               frames != max_frames) {
+            run_sid(&sid_us, (frames + 1) * frame_us);
+            good = replay_frame(frames, (frames + 1) * frame_us, writes,
+                                teletext, dir);
+            writes = 0;
+            frames++;
+        }
+        if (frames == max_frames) {
+            break;
+        }
+        run_sid(&sid_us, r.time_us);
+        eb_set(r.address, r.data);
+        eb_dispatch_write(r.address);
+        writes++;
+    }
+    if (good && frames != max_frames) {
+        good = replay_frame(frames, (frames + 1) * frame_us, writes, teletext,
+                            dir);
+    }
+
+    if (wav) {
+        write_wav_header();
+        fclose(wav);
+    }
+    fclose(f);
+    return good ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+/*
+
+Settings kept in flash across power cycles
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "settings.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/stdlib.h"
+#include "videomode.h"
+
+// the last sector of the flash, well clear of the program
+#define SETTINGS_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+
+#define SETTINGS_MAGIC 0x41445331u  // "ADS1"
+
+struct saved_settings {
+    uint32_t magic;
+    struct settings settings;
+    uint32_t check;  // the magic inverted, so an erased sector is not taken
+};
+
+/// @brief the saved settings, NULL if none have been saved
+static const struct settings* get_saved() {
+    const struct saved_settings* saved =
+        (const struct saved_settings*)(XIP_BASE + SETTINGS_OFFSET);
+    if (saved->magic == SETTINGS_MAGIC && saved->check == ~SETTINGS_MAGIC) {
+        return &saved->settings;
+    }
+    return NULL;
+}
+
+void settings_load(struct settings* settings) {
+    const struct settings* saved = get_saved();
+    if (saved && video_mode_usable(saved->mode)) {
+        *settings = *saved;
+        return;
+    }
+    settings->mode = MODE;
+#ifdef TELETEXT
+    settings->teletext = true;
+#else
+    settings->teletext = false;
+#endif
+}
+
+void settings_save(const struct settings* settings) {
+    // each save erases the sector
+    const struct settings* saved = get_saved();
+    if (saved && saved->mode == settings->mode &&
+        saved->teletext == settings->teletext) {
+        return;
+    }
+    static uint8_t page[FLASH_PAGE_SIZE];
+    static_assert(sizeof(struct saved_settings) <= FLASH_PAGE_SIZE,
+                  "settings are bigger than a flash page");
+    memset(page, 0xff, sizeof(page));
+    const struct saved_settings saved = {.magic = SETTINGS_MAGIC,
+                                         .settings = *settings,
+                                         .check = ~SETTINGS_MAGIC};
+    memcpy(page, &saved, sizeof(saved));
+
+    const uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(SETTINGS_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(SETTINGS_OFFSET, page, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+}
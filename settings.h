@@ -0,0 +1,49 @@
+/*
+
+Settings kept in flash across power cycles
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The video mode and renderer are chosen at boot from the settings saved in
+// the last sector of the flash. Until some have been saved they are MODE and
+// TELETEXT from CMakeLists.txt. Holding the capture button at power on and
+// letting it go steps to the next video mode. Holding it at power on and,
+// once the Atom has come out of reset, holding BREAK down for a second
+// switches between the 6847 and teletext, see main.c.
+
+/// @brief the settings
+struct settings {
+    uint8_t mode;   ///< one of the MODE_ values in videomode.h
+    bool teletext;  ///< draw teletext in place of the 6847
+};
+
+/// @brief read the saved settings
+/// @param settings filled in with the saved settings, or the defaults if
+/// none have been saved or they are for a mode this build cannot use
+void settings_load(struct settings* settings);
+
+/// @brief save the settings, only while nothing else is using the flash. The
+/// flash is left alone if it already holds them.
+/// @param settings the settings
+void settings_save(const struct settings* settings);
@@ -0,0 +1,61 @@
+/*
+
+The reSID emulation as set up for the Atom SID board
+
+Copyright 2021-2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "sid_emu.h"
+
+#include <stddef.h>
+
+#include "resid-0.16/sid.h"
+
+static SID *sid16 = NULL;
+
+extern "C" bool sid_emu_init()
+{
+    sid16 = new SID();
+    sid16->set_chip_model(MOS8580);
+    // sid16->set_chip_model(MOS6581);
+    sid16->reset();
+    // bool ok = sid16->set_sampling_parameters(SID_EMU_CLOCK, SAMPLE_INTERPOLATE, SID_EMU_SAMPLE_RATE);
+    bool ok = sid16->set_sampling_parameters(SID_EMU_CLOCK, SAMPLE_FAST, SID_EMU_SAMPLE_RATE);
+    sid16->enable_filter(true);
+    sid16->enable_external_filter(true);
+
+    sid16->input(0);
+    sid_emu_clear();
+    return ok;
+}
+
+extern "C" void sid_emu_clear()
+{
+    for (int i = 0; i < SID_EMU_REGS; i++)
+    {
+        sid16->write(i, 0);
+    }
+}
+
+extern "C" void sid_emu_write(int reg, uint8_t data) { sid16->write(reg, data); }
+
+extern "C" uint8_t sid_emu_read(int reg) { return sid16->read(reg); }
+
+extern "C" int sid_emu_output(int bits) { return sid16->output(bits); }
+
+extern "C" void sid_emu_clock() { sid16->clock(SID_EMU_TICK_US); }
@@ -0,0 +1,68 @@
+/*
+
+The reSID emulation as set up for the Atom SID board
+
+Copyright 2021-2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Nothing here uses the SDK, so that render_util/trace_replay plays the SID
+// writes of a trace through the same emulation
+
+#define SID_EMU_CLOCK 1000000
+#define SID_EMU_SAMPLE_RATE 50000
+#define SID_EMU_TICK_US (SID_EMU_CLOCK / SID_EMU_SAMPLE_RATE)
+// registers, the last four are read only
+#define SID_EMU_REGS 29
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @brief create the SID, an 8580 with its filters, all registers 0
+/// @return false if reSID cannot sample at SID_EMU_SAMPLE_RATE
+bool sid_emu_init(void);
+
+/// @brief set all the registers to 0, so it stops making a noise
+void sid_emu_clear(void);
+
+/// @brief write a register
+/// @param reg the register, 0 to SID_EMU_REGS - 1
+/// @param data the value
+void sid_emu_write(int reg, uint8_t data);
+
+/// @brief read a register
+/// @param reg the register, 0 to SID_EMU_REGS - 1
+/// @return the value
+uint8_t sid_emu_read(int reg);
+
+/// @brief get the current sample
+/// @param bits bits in the sample
+/// @return the sample, signed
+int sid_emu_output(int bits);
+
+/// @brief run the SID for a sample period, SID_EMU_TICK_US
+void sid_emu_clock(void);
+
+#ifdef __cplusplus
+}
+#endif
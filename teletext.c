@@ -24,9 +24,12 @@ Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "atom_if.h"
 #include "colours.h"
+#include "eb_handlers.h"
+#include "hstx_line.h"
 
 #define FONT_CHARS 0x60
 #define FONT_HEIGHT 12
@@ -37,6 +40,15 @@ extern uint8_t fontdata_saa5050_b[];
 static uint16_t font[FONT_CHARS * FONT2_HEIGHT];
 unsigned char teletext_regs[TELETEXT_REG_COUNT] = {0};
 
+// lines in a character row and in the page for the video mode, set by
+// teletext_init()
+static int row_height = TELETEXT_ROW_HEIGHT;
+static int page_lines = TELETEXT_LINES;
+// the first line of the bottom of the 2x3 graphics
+static int graphic_bottom;
+// the lines left blank by separated graphics
+static uint32_t separated_mask;
+
 static inline int get_start_address() {
     return teletext_regs[TELETEXT_REG_START_ADDR_H] * 256 + teletext_regs[TELETEXT_REG_START_ADDR_L];
 }
@@ -51,11 +63,7 @@ static inline void write_pixel(pixel_t** pp, pixel_t c) {
 }
 
 static inline int teletext_line_no(int line_num) {
-    if (MODE_V_ACTIVE_LINES >= TELETEXT_LINES) {
-        return line_num - (MODE_V_ACTIVE_LINES - TELETEXT_LINES) / 2;
-    } else {
-        return line_num * MODE_V_ACTIVE_LINES / TELETEXT_LINES;
-    }
+    return line_num - (MODE_V_ACTIVE_LINES - page_lines) / 2;
 }
 
 /// @brief lookup table for solid graphics
@@ -69,25 +77,23 @@ static uint16_t separated_lut[] = {0b0000000000000000, 0b0111100000000000,
 // the 20 lines in the 2x3 graphics are laid out as follows
 //   0  1  2  3  4  5                         14 15 16 17 18 19
 //                     6  7  8  9 10 11 12 13
-static inline uint16_t lookup_graphic(uint8_t c, int sub_row, bool separated,
-                                      bool second_double) {
-    if (second_double) {
-        return SPACE;
-    }
+// and with 19 lines the middle is a line shorter
+//   0  1  2  3  4  5                      13 14 15 16 17 18
+//                     6  7  8  9 10 11 12
+static inline uint16_t lookup_graphic(uint8_t c, int sub_row, bool separated) {
     c = c - 0x20;
 
     int index;
     if (sub_row < 6) {
         index = c & 0b11;
-    } else if (sub_row > 13) {
+    } else if (sub_row >= graphic_bottom) {
         index = ((c >> 4) & 1) + ((c >> 5) & 2);
     } else {  // c >= 7 && c <= 13
         index = (c >> 2) & 0b11;
     }
 
     if (separated) {
-        const static int mask = 0b10000110000001100001;
-        if ((1 << sub_row) & mask) {
+        if ((1 << sub_row) & separated_mask) {
             return SPACE;
         };
         return separated_lut[index];
@@ -97,74 +103,114 @@ static inline uint16_t lookup_graphic(uint8_t c, int sub_row, bool separated,
 }
 
 
-static inline uint16_t lookup_character(uint8_t ch, const int sub_row,
-                                        bool double_height,
-                                        bool second_double) {
-    ch = ch - 0x20;
+/// @brief get a character's lines in the font
+static inline const uint16_t* glyph(uint8_t ch) {
+    return font + (ch - 0x20) * FONT2_HEIGHT;
+}
 
-    const uint16_t* fontdata;
-    if (second_double) {
-        if (double_height) {
-            fontdata = font + sub_row / 2 + 10;  // + (10 - 19)
-        } else {
-            return SPACE;
-        }
-    } else {
-        if (double_height) {
-            fontdata = font + sub_row / 2;  // + (0..9)
-        } else {
-            fontdata = font + sub_row;  // font + (0..19)
+static const pixel_t colours[] = {AT_BLACK, AT_RED,     AT_GREEN, AT_YELLOW,
+                                  AT_BLUE,  AT_MAGENTA, AT_CYAN,  AT_WHITE};
+
+#define COLOUR_BLACK 0
+#define COLOUR_WHITE 7
+
+// Four pixels for each nibble of a glyph line in each pair of colours, so
+// that a cell is three table loads and stores. Indexed by the foreground and
+// background colours, 0 - 7 as in the control codes. 4 KB, or 2 KB with
+// PACKED_PIXELS.
+static pixel4_t nibble_lut[8][8][16];
+// the control codes shown in orange when debugging, on black and on white
+static pixel4_t debug_lut[2][16];
+
+static void init_nibble_luts() {
+    for (int fg = 0; fg < 8; fg++) {
+        for (int bg = 0; bg < 8; bg++) {
+            for (int n = 0; n < 16; n++) {
+                nibble_lut[fg][bg][n] = nibble_pixels(
+                    n, pack_colour(colours[fg]), pack_colour(colours[bg]));
+            }
         }
     }
-    return fontdata[ch * FONT2_HEIGHT];
+    for (int n = 0; n < 16; n++) {
+        debug_lut[0][n] = nibble_pixels(n, pack_colour(AT_ORANGE),
+                                        pack_colour(AT_BLACK));
+        debug_lut[1][n] = nibble_pixels(n, pack_colour(AT_ORANGE),
+                                        pack_colour(AT_WHITE));
+    }
 }
 
-/// @brief reverse and expand a 4-bit bitmap.
-/// WXYZ (binary) -> 0Z0Y0X0W (hex)
-/// eg. 0b1011 -> 0x01010001
-/// @param bitmap the bitmap - only first 4 bits are used
-/// @return the expanded bitmap
-static inline unsigned int bitmap_to_uint(unsigned char bitmap) {
-    const int mask = 0x1010101;
-    int x = bitmap & 0xF;
-    x += (x << 9);
-    x += (x << 18);
-    return (x >> 3) & mask;
+/// @brief draw the 12 pixels of a cell
+/// @param p where to draw them
+/// @param lut the cell's colours in nibble_lut or debug_lut
+/// @param bitmap the pixels, the first in bit 15
+/// @return the pixel after them
+static inline pixel_t* out12_pixels(pixel_t* p, const pixel4_t* lut,
+                                    uint16_t bitmap) {
+    pixel4_t* q = (pixel4_t*)p;
+    q[0] = lut[bitmap >> 12];
+    q[1] = lut[(bitmap >> 8) & 15];
+    q[2] = lut[(bitmap >> 4) & 15];
+    return p + PIXEL_BYTES(12);
 }
 
-static inline unsigned int bitmap_to_pixels(pixel_t* p, unsigned char fg_colour,
-                                            unsigned char bg_colour,
-                                            unsigned int bitmap) {
-    unsigned int retval = bitmap_to_uint(bitmap);
-    retval = retval * fg_colour + (retval ^ 0x01010101) * bg_colour;
-    return retval;
-}
-
-static inline pixel_t* out12_pixels(pixel_t* p, unsigned char fg_colour,
-                                    unsigned char bg_colour, uint16_t bitmap) {
-    unsigned int* q = (unsigned int*)p;
-
-    q[0] = bitmap_to_pixels(p, fg_colour, bg_colour, bitmap >> 12);
-    q[1] = bitmap_to_pixels(p, fg_colour, bg_colour, bitmap >> 8);
-    q[2] = bitmap_to_pixels(p, fg_colour, bg_colour, bitmap >> 4);
-
-    return p + 12;
+// What is drawn in a character cell, decoded from the control codes once for
+// a character row by build_row() so that each line of the row only fetches
+// the glyph lines and expands them
+enum cell_kind {
+    CELL_SPACE,
+    CELL_CHAR,    // glyph
+    CELL_DOUBLE,  // glyph at double height
+    CELL_GRAPHIC  // the mosaic ch
+};
+
+// drawn in place of the last two lines of a cell
+enum cell_underline { UNDERLINE_NONE, UNDERLINE_CURSOR, UNDERLINE_DEBUG };
+
+struct teletext_cell {
+    const uint16_t* glyph;
+    uint8_t kind;
+    uint8_t underline;
+    uint8_t ch;
+    bool separated;
+    const pixel4_t* lut;  // the colours, in nibble_lut or debug_lut
+};
+
+static struct {
+    int row;             // the character row decoded, -1 for none
+    bool second_double;  // the row shows the bottom of double height
+    // the page bytes decoded, a row that the 6502 writes to is decoded again
+    // for its remaining lines
+    uint8_t chars[TELETEXT_COLUMNS];
+    struct teletext_cell cells[TELETEXT_COLUMNS];
+} current_row = {.row = -1};
+
+/// @brief check whether the page bytes of the decoded row have changed
+static inline bool row_changed() {
+    const int start_char =
+        get_start_address() + current_row.row * TELETEXT_COLUMNS;
+    for (int col = 0; col < TELETEXT_COLUMNS; col++) {
+        const int char_address =
+            ((start_char + col) % 0x400) + TELETEXT_PAGE_BUFFER;
+        if (eb_get(char_address) != current_row.chars[col]) {
+            return true;
+        }
+    }
+    return false;
 }
 
-static const pixel_t colours[] = {AT_BLACK, AT_RED,     AT_GREEN, AT_YELLOW,
-                                  AT_BLUE,  AT_MAGENTA, AT_CYAN,  AT_WHITE};
-
-pixel_t* do_teletext(pixel_t* _p, size_t len, unsigned int line_num,
-                     unsigned char flags) {
-    pixel_t* retval = _p;
+// Set when every row has to be decoded again, see teletext_invalidate()
+static volatile bool rows_dirty = false;
 
-    static int next_double = -1;
-    static int frame_count = 0;
-    static bool flash_now = false;
-    static bool blink_now = false;
+static int next_double = -1;
+static bool flash_now = false;
+static bool blink_now = false;
 
-    pixel_t fg_colour = AT_WHITE;
-    pixel_t bg_colour = AT_BLACK;
+/// @brief decode the control codes of a character row
+/// @param row the character row
+/// @param flags TELETEXT_REG_FLAGS
+static void build_row(int row, unsigned char flags) {
+    int fg_colour = COLOUR_WHITE;
+    int bg_colour = COLOUR_BLACK;
 
     bool is_debug = flags & 0x01;
     bool reveal = flags & 0x02;
@@ -175,34 +221,13 @@ pixel_t* do_teletext(pixel_t* _p, size_t len, unsigned int line_num,
     // bool box = false;
     bool separated_graphics = false;
     bool hold_graphics = false;
-    int last_graph_bitmap = SPACE;
-
-    // Screen is 25 rows x 40 columns
-    int relative_line_num = teletext_line_no(line_num);
-    if (relative_line_num < 0 || relative_line_num >= TELETEXT_LINES) {
-        int* q = (int*)retval;
-        for (int i = 0; i < MODE_H_ACTIVE_PIXELS / 4; i++) {
-            q[i] = AT_BLACK;
-        }
-        hard_assert(len == MODE_H_ACTIVE_PIXELS);
-        return retval + MODE_H_ACTIVE_PIXELS;
-    }
-
-    retval += (MODE_H_ACTIVE_PIXELS - TELETEXT_H_PIXELS) / 2;
+    const struct teletext_cell space = {.kind = CELL_SPACE};
+    struct teletext_cell last_graphic = space;
 
-    const int row = (relative_line_num) / TELETEXT_ROW_HEIGHT;  // character row
-    const int sub_row =
-        relative_line_num -
-        (TELETEXT_ROW_HEIGHT * row);  // row within current character (0..19)
-
-    // start of frame initialisation
-    if (relative_line_num == 0) {
-        next_double = -1;
-        // toggle the flash flag
-        frame_count = (frame_count + 1) & 63;
-        flash_now = frame_count < 21;
-        blink_now = frame_count < 32;
-    };
+    rows_dirty = false;
+    current_row.row = row;
+    const bool second_double = next_double == row;
+    current_row.second_double = second_double;
 
     //int ch_index = TELETEXT_PAGE_BUFFER + row * TELETEXT_COLUMNS;
     int start_address = get_start_address();
@@ -210,8 +235,10 @@ pixel_t* do_teletext(pixel_t* _p, size_t len, unsigned int line_num,
     int cursor_address = get_cursor_address();
 
     for (int col = 0; col < TELETEXT_COLUMNS; col++) {
+        struct teletext_cell* cell = &current_row.cells[col];
         int char_address = ((start_char + col) % 0x400) + TELETEXT_PAGE_BUFFER;
-        int ch = eb_get(char_address) & 0x7F;
+        current_row.chars[col] = eb_get(char_address);
+        int ch = current_row.chars[col] & 0x7F;
         bool non_printing = (ch < 0x20);
 
         // pre-render
@@ -219,7 +246,7 @@ pixel_t* do_teletext(pixel_t* _p, size_t len, unsigned int line_num,
             switch (ch) {
                 case NORMAL_HEIGHT:
                     if (double_height) {
-                        last_graph_bitmap = SPACE;
+                        last_graphic = space;
                         double_height = false;
                     }
                     break;
@@ -228,13 +255,13 @@ pixel_t* do_teletext(pixel_t* _p, size_t len, unsigned int line_num,
                         next_double = row + 1;
                     }
                     if (!double_height) {
-                        last_graph_bitmap = SPACE;
+                        last_graphic = space;
                         double_height = true;
                     }
                     break;
 
                 case BLACK_BACKGROUND:
-                    bg_colour = AT_BLACK;
+                    bg_colour = COLOUR_BLACK;
                     break;
 
                 case NEW_BACKGROUND:
@@ -247,7 +274,7 @@ pixel_t* do_teletext(pixel_t* _p, size_t len, unsigned int line_num,
             }
         }
 
-        uint16_t bitmap;
+        *cell = space;
         if (non_printing) {
             if (is_debug) {
                 int temp = ch & 0xF;
@@ -256,60 +283,51 @@ pixel_t* do_teletext(pixel_t* _p, size_t len, unsigned int line_num,
                 } else {
                     temp = temp + 'a' - 10;
                 }
-                bitmap = lookup_character(temp, sub_row, false, false);
-            } else {
+                cell->kind = CELL_CHAR;
+                cell->glyph = glyph(temp);
+            } else if (hold_graphics) {
                 // non-printing char
-                if (hold_graphics) {
-                    bitmap = last_graph_bitmap;
-                } else {
-                    bitmap = SPACE;
-                }
+                *cell = last_graphic;
             }
         } else {
             if (graphics && (ch & (0x1 << 5))) {
-                bitmap = lookup_graphic(ch, sub_row, separated_graphics,
-                                        next_double == row);
-                last_graph_bitmap = bitmap;
-            } else {
-                bitmap = lookup_character(ch, sub_row, double_height,
-                                          next_double == row);
+                if (!second_double) {
+                    cell->kind = CELL_GRAPHIC;
+                    cell->ch = ch;
+                    cell->separated = separated_graphics;
+                }
+                last_graphic = *cell;
+            } else if (double_height) {
+                cell->kind = CELL_DOUBLE;
+                cell->glyph = glyph(ch);
+            } else if (!second_double) {
+                cell->kind = CELL_CHAR;
+                cell->glyph = glyph(ch);
             }
         }
 
         if (non_printing && is_debug) {
-            pixel_t f, b;
-            if (ch & 0x10) {
-                f = AT_ORANGE;
-                b = AT_WHITE;
-            } else {
-                f = AT_ORANGE;
-                b = AT_BLACK;
-            }
-            if (sub_row >= 18) {
-                // dotted underline
-                bitmap = 0x9999;
-            }
-            retval = out12_pixels(retval, f, b, bitmap);
+            cell->lut = debug_lut[(ch & 0x10) ? 1 : 0];
+            // dotted underline
+            cell->underline = UNDERLINE_DEBUG;
         } else {
             if ((conceal && !reveal) || (flash && flash_now)) {
                 // handle conceal and flash
-                bitmap = SPACE;
+                cell->kind = CELL_SPACE;
+            }
+            cell->lut = nibble_lut[fg_colour][bg_colour];
+            if (char_address == cursor_address && blink_now) {
+                cell->underline = UNDERLINE_CURSOR;
             }
-            if (char_address == cursor_address && sub_row>=18 && blink_now)
-            {                
-                retval = out12_pixels(retval, AT_WHITE, AT_BLACK, 0xFFFF);
-            } else {
-                retval = out12_pixels(retval, fg_colour, bg_colour, bitmap);
-            }            
         }
 
         // post-render
         if (non_printing) {
             switch (ch) {
                 case ALPHA_RED ... ALPHA_WHITE:
-                    fg_colour = colours[ch];
+                    fg_colour = ch;
                     if (graphics) {
-                        last_graph_bitmap = SPACE;
+                        last_graphic = space;
                         graphics = false;
                     }
                     conceal = false;
@@ -327,9 +345,9 @@ pixel_t* do_teletext(pixel_t* _p, size_t len, unsigned int line_num,
                 //     box = true;
                 //     break;
                 case GRAPHICS_RED ... GRAPHICS_WHITE:
-                    fg_colour = colours[ch & 7];
+                    fg_colour = ch & 7;
                     if (!graphics) {
-                        last_graph_bitmap = SPACE;
+                        last_graphic = space;
                         graphics = true;
                     }
                     conceal = false;
@@ -349,7 +367,88 @@ pixel_t* do_teletext(pixel_t* _p, size_t len, unsigned int line_num,
             }
         }
     }
-    hard_assert((retval - _p) <= len);
+}
+
+pixel_t* do_teletext(pixel_t* _p, size_t len, unsigned int line_num,
+                     unsigned char flags) {
+    pixel_t* retval = _p;
+
+    static int frame_count = 0;
+
+    // Screen is 25 rows x 40 columns
+    int relative_line_num = teletext_line_no(line_num);
+    if (relative_line_num < 0 || relative_line_num >= page_lines) {
+        int* q = (int*)retval;
+        for (int i = 0; i < MODE_H_ACTIVE_PIXELS / PIXELS_PER_WORD; i++) {
+            q[i] = AT_BLACK;
+        }
+        hard_assert(len == MODE_H_ACTIVE_PIXELS);
+        return retval + PIXEL_BYTES(MODE_H_ACTIVE_PIXELS);
+    }
+
+    // the margins are black rather than whatever the buffer last held
+    const size_t margin =
+        PIXEL_BYTES((MODE_H_ACTIVE_PIXELS - TELETEXT_H_PIXELS) / 2);
+    memset(retval, AT_BLACK, margin);
+    retval += margin;
+
+    const int row = (relative_line_num) / row_height;  // character row
+    const int sub_row =
+        relative_line_num -
+        (row_height * row);  // row within current character (0..19)
+    const int underline_row = row_height - 2;
+
+    // start of frame initialisation
+    if (relative_line_num == 0) {
+        next_double = -1;
+        // toggle the flash flag
+        frame_count = (frame_count + 1) & 63;
+        flash_now = frame_count < 21;
+        blink_now = frame_count < 32;
+    };
+
+    if (sub_row == 0 || row != current_row.row || rows_dirty ||
+        row_changed()) {
+        build_row(row, flags);
+    }
+
+    // the line of double height glyphs, + (0..9) for the top half, + (10..19)
+    // for the bottom, or (9..18) with 19 lines
+    const int double_row = current_row.second_double
+                               ? (row_height + sub_row) / 2
+                               : sub_row / 2;
+    const bool underline = sub_row >= underline_row;
+
+    const struct teletext_cell* cell = current_row.cells;
+    for (int col = 0; col < TELETEXT_COLUMNS; col++, cell++) {
+        uint16_t bitmap;
+        switch (cell->kind) {
+            case CELL_CHAR:
+                bitmap = cell->glyph[sub_row];
+                break;
+            case CELL_DOUBLE:
+                bitmap = cell->glyph[double_row];
+                break;
+            case CELL_GRAPHIC:
+                bitmap = lookup_graphic(cell->ch, sub_row, cell->separated);
+                break;
+            default:
+                bitmap = SPACE;
+                break;
+        }
+        if (underline && cell->underline == UNDERLINE_CURSOR) {
+            retval = out12_pixels(
+                retval, nibble_lut[COLOUR_WHITE][COLOUR_BLACK], 0xFFFF);
+            continue;
+        }
+        if (underline && cell->underline == UNDERLINE_DEBUG) {
+            bitmap = 0x9999;
+        }
+        retval = out12_pixels(retval, cell->lut, bitmap);
+    }
+    memset(retval, AT_BLACK, margin);
+    retval += margin;
+    hard_assert((retval - _p) <= PIXEL_BYTES(len));
     return retval;
 }
 
@@ -424,6 +523,12 @@ void init_font() {
         uint8_t* src = fontdata_saa5050_b + ch * 12;
         dest_ptr = convert_char(dest_ptr, src);
     }
+    // The last of the 20 lines is rounded from the font's last two lines,
+    // which are blank in every character, so the 19 line glyphs are the
+    // first 19 lines of each and lose nothing
+    for (int ch = 0; ch < 0x60; ch += 1) {
+        hard_assert(font[ch * FONT2_HEIGHT + FONT2_HEIGHT - 1] == 0);
+    }
 }
 
 void print_pixels(uint16_t p) {
@@ -463,16 +568,35 @@ void print_font(uint16_t* font) {
     }
 }
 
+static void crtc_write(uint16_t address, void* ctx) {
+    teletext_reg_write(address, eb_get(address));
+}
+
 void teletext_init(void) {
     //eb_set_perm(TELETEXT_PAGE_BUFFER, EB_PERM_WRITE_ONLY, 0x400);
     teletext_regs[TELETEXT_REG_CURSOR_H] = TELETEXT_PAGE_BUFFER / 256;
     teletext_regs[TELETEXT_REG_CURSOR_L] = TELETEXT_PAGE_BUFFER % 256;
     teletext_regs[TELETEXT_REG_START_ADDR_H] = TELETEXT_PAGE_BUFFER / 256;
     teletext_regs[TELETEXT_REG_START_ADDR_L] = TELETEXT_PAGE_BUFFER % 256;
-    
+
+    // 25 rows of 20 lines do not fit in 480 lines, 25 of 19 do
+    row_height = MODE_V_ACTIVE_LINES >= TELETEXT_LINES
+                     ? TELETEXT_ROW_HEIGHT
+                     : TELETEXT_SHORT_ROW_HEIGHT;
+    page_lines = TELETEXT_ROWS * row_height;
+    graphic_bottom = row_height - 6;
+    separated_mask = 1u << 0 | 1u << 5 | 1u << 6 | 1u << (graphic_bottom - 1) |
+                     1u << graphic_bottom | 1u << (row_height - 1);
+
     init_font();
+    init_nibble_luts();
+
+    const bool ok = eb_register_write_handler(TELETEXT_CRTA, 2, crtc_write, NULL);
+    hard_assert(ok);
+    (void)ok;  // when hard_assert() is compiled out
 }
 
+void teletext_invalidate(void) { rows_dirty = true; }
 
 void teletext_reg_write(int reg, unsigned char val)
 {
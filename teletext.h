@@ -62,8 +62,11 @@ enum  saa5050_ctrl {
     RELEASE_GRAPHICS = 31
 } ;
 
-#define TELETEXT_LINES 500
+// Rows are TELETEXT_ROW_HEIGHT lines high, or TELETEXT_SHORT_ROW_HEIGHT in
+// modes with fewer than TELETEXT_LINES lines, see teletext_init()
 #define TELETEXT_ROW_HEIGHT 20
+#define TELETEXT_SHORT_ROW_HEIGHT 19
+#define TELETEXT_LINES (TELETEXT_ROWS * TELETEXT_ROW_HEIGHT)
 #define TELETEXT_COLUMNS 40
 #define TELETEXT_ROWS 25
 #define TELETEXT_H_PIXELS (TELETEXT_COLUMNS * 12)
@@ -127,7 +130,11 @@ extern "C" {
 
 pixel_t* do_teletext(pixel_t* p, size_t len, unsigned int line_num, unsigned char flags);
 void teletext_init(void);
+/// @brief decode the row being drawn again, and so every row after it, after
+/// a change that the page bytes do not show, such as lost bus events
+void teletext_invalidate(void);
 void teletext_reg_write(int reg, unsigned char val);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,184 @@
+/*
+
+Recording the 6502's writes to a file on the USB stick
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "trace.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "atom_if.h"
+#include "capture.h"
+#include "ff.h"
+#include "pico/stdlib.h"
+
+#if BUS_TRACE
+
+#define FILE_PREFIX "trc"
+#define FILE_EXTENSION ".bin"
+
+static_assert((TRACE_RING_RECORDS & (TRACE_RING_RECORDS - 1)) == 0 &&
+                  TRACE_RING_RECORDS % TRACE_BLOCK_RECORDS == 0,
+              "the ring must be a power of 2 and whole blocks");
+
+static struct trace_record ring[TRACE_RING_RECORDS];
+// head is only changed by trace_write() and tail by trace_task(), both on
+// core 1
+static volatile uint32_t head;
+static volatile uint32_t tail;
+static volatile bool recording;
+static uint32_t start_us;
+
+static struct trace_header header;
+static uint32_t events_dropped_at_start;
+static FIL file;
+
+void trace_init(uint8_t mode, bool teletext) {
+    header.mode = mode;
+    header.teletext = teletext;
+}
+
+void __not_in_flash_func(trace_write)(uint16_t address, uint8_t data) {
+    if (!recording) {
+        return;
+    }
+    const uint32_t h = head;
+    if (h - tail == TRACE_RING_RECORDS) {
+        header.dropped++;
+        return;
+    }
+    ring[h % TRACE_RING_RECORDS] = (struct trace_record){
+        .time_us = time_us_32() - start_us, .address = address, .data = data};
+    __dmb();
+    head = h + 1;
+}
+
+/// @brief write to the trace file
+/// @return false if it could not all be written
+static bool write_file(const void* data, UINT size) {
+    UINT written;
+    return f_write(&file, data, size, &written) == FR_OK && written == size;
+}
+
+/// @brief write records from the ring to the file
+/// @param count records to write, in the ring and within a block
+static bool write_records(uint32_t count) {
+    const struct trace_record* r = &ring[tail % TRACE_RING_RECORDS];
+    if (!write_file(r, count * sizeof(*r))) {
+        return false;
+    }
+    header.records += count;
+    tail += count;
+    return true;
+}
+
+static void stop(bool good) {
+    recording = false;
+    // the rest of the records, up to the end of the ring then from the start
+    while (good && head != tail) {
+        uint32_t count = head - tail;
+        const uint32_t to_end =
+            TRACE_RING_RECORDS - tail % TRACE_RING_RECORDS;
+        good = write_records(count < to_end ? count : to_end);
+    }
+    struct eb_event_stats stats;
+    eb_get_event_stats(&stats);
+    header.events_dropped = stats.dropped - events_dropped_at_start;
+    if (good) {
+        good = f_lseek(&file, 0) == FR_OK && write_file(&header, sizeof(header));
+    }
+    f_close(&file);
+    printf("trace %s, %lu records, %lu dropped, %lu events dropped\n",
+           good ? "saved" : "not saved", (unsigned long)header.records,
+           (unsigned long)header.dropped,
+           (unsigned long)header.events_dropped);
+}
+
+static void start() {
+    char fname[32];
+    f_mkdir(CAPTURE_DIR);
+    const int fnum = last_file_number(CAPTURE_DIR, FILE_PREFIX);
+    if (fnum < 0) {
+        printf("cannot open " CAPTURE_DIR "\n");
+        return;
+    }
+    sprintf(fname, CAPTURE_DIR "/" FILE_PREFIX "%04d" FILE_EXTENSION,
+            fnum + 1);
+    if (f_open(&file, fname, FA_CREATE_NEW | FA_WRITE) != FR_OK) {
+        printf("cannot open %s\n", fname);
+        return;
+    }
+    printf("trace to %s, 't' to stop\n", fname);
+
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.header_size = sizeof(header);
+    header.records = 0;
+    header.dropped = 0;
+    struct eb_event_stats stats;
+    eb_get_event_stats(&stats);
+    events_dropped_at_start = stats.dropped;
+
+    // Recording starts before the memory is saved, so that writes made while
+    // it is being saved are in the trace. Replaying them again is harmless.
+    head = tail = 0;
+    start_us = time_us_32();
+    recording = true;
+    bool good = write_file(&header, sizeof(header));
+    static uint8_t block[TRACE_BLOCK_RECORDS * sizeof(struct trace_record)];
+    for (uint32_t address = 0; good && address < EB_ADDRESS_HIGH;
+         address += sizeof(block)) {
+        eb_read_block(block, address, sizeof(block));
+        good = write_file(block, sizeof(block));
+    }
+    if (!good) {
+        stop(false);
+    }
+}
+
+void trace_toggle() {
+    if (recording) {
+        stop(true);
+    } else {
+        start();
+    }
+}
+
+void trace_task() {
+    if (recording && head - tail >= TRACE_BLOCK_RECORDS) {
+        // blocks never span the end of the ring
+        if (!write_records(TRACE_BLOCK_RECORDS)) {
+            stop(false);
+        }
+    }
+}
+
+#else
+
+void trace_init(uint8_t mode, bool teletext) {}
+
+void trace_toggle() {}
+
+void trace_write(uint16_t address, uint8_t data) {}
+
+void trace_task() {}
+
+#endif
@@ -0,0 +1,107 @@
+/*
+
+Recording the 6502's writes to a file on the USB stick
+
+Copyright 2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Build with BUS_TRACE=1 to record the writes on the bus event queue, with
+// the time each was handled, while 't' on the UART is toggled on. Only
+// writes to addresses with a notify permission are events, see atom_if.h.
+// The display does not need events for video memory, but with BUS_TRACE
+// mc6847_init() gives it a notify permission so that the writes are traced.
+//
+// The records are kept in a ring in RAM and written a TRACE_BLOCK_RECORDS
+// block at a time to /atom/trcNNNN.bin on the USB stick. A trace is the
+// header, the 64 KB of memory as it was when the trace started, then the
+// records. render_util/trace_replay plays a trace back. Writing a block takes
+// longer than a SID sample, so with BUS_TRACE as_run() clocks the SID from a
+// timer interrupt and the blocks are written from its loop in between.
+//
+// LIMITATION: the time and the value of each record are taken when the event
+// IRQ handles the write, not when the 6502 makes it. The bus event queue
+// holds only the address, so the value is read from the shadow memory, which
+// by then holds the last value written there. Writes waiting in the queue,
+// from a burst or with EB_EVENT_COALESCE above 1, are recorded with the time
+// they were handled, and two writes to the same address waiting together are
+// both recorded with the second value. A trace shows the order of the writes
+// to different addresses, but not the values of repeated writes to one
+// address in quick succession, such as a sequence of SID gate changes.
+
+#define TRACE_MAGIC 0x43525441u  // "ATRC"
+#define TRACE_VERSION 1
+
+// Records in the ring and in a block written to the file, powers of 2
+#ifndef TRACE_RING_RECORDS
+#define TRACE_RING_RECORDS 4096
+#endif
+#define TRACE_BLOCK_RECORDS 512
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @brief the start of a trace file, little endian
+struct trace_header {
+    uint32_t magic;           ///< TRACE_MAGIC
+    uint16_t version;         ///< TRACE_VERSION
+    uint16_t header_size;     ///< bytes in the header
+    uint8_t mode;             ///< the MODE_ value of the video mode
+    uint8_t teletext;         ///< teletext in place of the 6847
+    uint16_t reserved;
+    uint32_t records;         ///< records in the file
+    uint32_t dropped;         ///< records lost when the ring was full
+    uint32_t events_dropped;  ///< events lost from the bus event queue
+};
+
+/// @brief a 6502 write, as seen when it was handled, see above
+struct trace_record {
+    uint32_t time_us;  ///< microseconds from the start of the trace to the
+                       ///< write being handled
+    uint16_t address;  ///< the 6502 address
+    uint8_t data;      ///< the value at the address when the write was
+                       ///< handled
+    uint8_t reserved;
+};
+
+/// @brief set what goes in the header of each trace
+/// @param mode the MODE_ value of the video mode
+/// @param teletext teletext in place of the 6847
+void trace_init(uint8_t mode, bool teletext);
+
+/// @brief start a trace if none is running, otherwise stop it
+void trace_toggle(void);
+
+/// @brief record a write if a trace is running, called from the bus event
+/// handler
+/// @param address the 6502 address
+/// @param data the value at the address now, which may be from a later write
+void trace_write(uint16_t address, uint8_t data);
+
+/// @brief write full blocks of records to the file, called from the main
+/// loop
+void trace_task(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -27,9 +27,13 @@ Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
 
 #include "atom_if.h"
 #include "capture.h"
+#include "genlock.h"
 #include "licence.h"
 #include "mc6847.h"
+#include "pico/stdio.h"
 #include "pico/util/queue.h"
+#include "trace.h"
+#include "render_stats.h"
 
 #define DOUBLE_CLICK_TIME 500
 
@@ -76,10 +80,8 @@ static void draw_box(int x, int y, int width, int height) {
     putgr(y, x + width, UPPER_RIGHT_CORNER);
     putgr(y + height, x, LOWER_LEFT_CORNER);
     putgr(y + height, x + width, LOWER_RIGHT_CORNER);
-    for (int i = 1; i < width; i++) {
-        putgr(y, x + i, HORIZONTAL_LINE);
-        putgr(y + height, x + i, HORIZONTAL_LINE);
-    }
+    eb_memset(0x8000 + y * 80 + x + 1, HORIZONTAL_LINE, width - 1);
+    eb_memset(0x8000 + (y + height) * 80 + x + 1, HORIZONTAL_LINE, width - 1);
     for (int i = 1; i < height; i++) {
         putgr(y + i, x, VERTICAL_LINE);
         putgr(y + i, x + width, VERTICAL_LINE);
@@ -158,5 +160,29 @@ void ui_run() {
             capture();
         }
     }
+    const int c = getchar_timeout_us(0);
+    // 'e' on the UART prints the bus event counts
+    if (c == 'e') {
+        eb_print_event_stats();
+    }
+#if RENDER_STATS
+    // 's' prints the line timings
+    if (c == 's') {
+        render_stats_print();
+    }
+#endif
+#if GENLOCK
+    // 'g' prints the genlock state
+    if (c == 'g') {
+        genlock_print();
+    }
+#endif
+#if BUS_TRACE
+    // 't' starts and stops a trace of the bus writes
+    if (c == 't') {
+        trace_toggle();
+    }
+#endif
     capture_task();
+    trace_task();
 }
@@ -0,0 +1,151 @@
+/*
+
+Video mode timings, chosen at boot
+
+Copyright 2021-2025 Chris Moulang
+
+This file is part of Atom-DVI
+
+Atom-DVI is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Atom-DVI is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+Atom-DVI. If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "videomode.h"
+
+#include <stddef.h>
+
+#include "genlock.h"
+#include "hstx_line.h"
+
+// Nothing here uses the SDK, so that render_util can pick a mode too
+
+// Each mode runs at the fastest clocks it has been tested with. The HSTX
+// sends a pixel every 5 of its clocks, so HSTX_CLK_KHZ is 5 times the pixel
+// clock, and the system clock is a multiple of it.
+static const struct video_mode modes[MODE_COUNT] = {
+    [MODE_800x600_60] = {.name = "800x600 60Hz",
+                         .h_front_porch = 40,
+                         .h_sync_width = 128,
+                         .h_back_porch = 88,
+                         .h_active_pixels = 800,
+                         .v_front_porch = 1,
+                         .v_sync_width = 4,
+                         .v_back_porch = 23,
+                         .v_active_lines = 600,
+                         .scale = 3,
+                         .sys_clk_khz = 200000,
+                         .hstx_clk_khz = 200000},
+    [MODE_720x576_60] = {.name = "720x576 60Hz",
+                         .h_front_porch = 48,
+                         .h_sync_width = 32,
+                         .h_back_porch = 80,
+                         .h_active_pixels = 720,
+                         .v_front_porch = 3,
+                         .v_sync_width = 7,
+                         .v_back_porch = 7,
+                         .v_active_lines = 576,
+                         .scale = 2,
+                         .sys_clk_khz = 156000,
+                         .hstx_clk_khz = 156000},
+    [MODE_640x480_60] = {.name = "640x480 60Hz",
+                         .h_front_porch = 16,
+                         .h_sync_width = 96,
+                         .h_back_porch = 48,
+                         .h_active_pixels = 640,
+                         .v_front_porch = 10,
+                         .v_sync_width = 2,
+                         .v_back_porch = 33,
+                         .v_active_lines = 480,
+                         .scale = 2,
+                         .sys_clk_khz = 125000,
+                         .hstx_clk_khz = 125000},
+    [MODE_640x480_60_FAST] = {.name = "640x480 60Hz fast",
+                              .h_front_porch = 16,
+                              .h_sync_width = 96,
+                              .h_back_porch = 48,
+                              .h_active_pixels = 640,
+                              .v_front_porch = 10,
+                              .v_sync_width = 2,
+                              .v_back_porch = 33,
+                              .v_active_lines = 480,
+                              .scale = 2,
+                              .sys_clk_khz = 250000,
+                              .hstx_clk_khz = 125000},
+    [MODE_640x480_60_FAST_DMT] = {.name = "640x480 60Hz fast DMT",
+                                  .h_front_porch = 8,
+                                  .h_sync_width = 96,
+                                  .h_back_porch = 40,
+                                  .h_active_pixels = 640,
+                                  .v_front_porch = 2,
+                                  .v_sync_width = 2,
+                                  .v_back_porch = 25,
+                                  .v_active_lines = 480,
+                                  .scale = 2,
+                                  .sys_clk_khz = 250000,
+                                  .hstx_clk_khz = 125000},
+};
+
+struct video_mode video_mode;
+
+uint32_t line_hsync[LINE_HSYNC_WORDS];
+
+const struct video_mode* video_mode_get(int mode) {
+    if (mode <= 0 || mode >= MODE_COUNT) {
+        return NULL;
+    }
+    return &modes[mode];
+}
+
+bool video_mode_usable(int mode) {
+    const struct video_mode* m = video_mode_get(mode);
+    if (!m) {
+        return false;
+    }
+#if GENLOCK
+    // lines are taken from the back porch to follow the Atom
+    if (m->v_back_porch <= GENLOCK_MAX_LINES) {
+        return false;
+    }
+#endif
+    // the lookup tables and line buffers are sized for the build's scale
+    return m->scale == XSCALE && m->h_active_pixels <= MODE_H_MAX_PIXELS &&
+           m->v_active_lines <= MODE_V_MAX_LINES &&
+           m->h_active_pixels >= 256 * XSCALE &&
+           m->v_active_lines >= 192 * YSCALE &&
+           m->v_front_porch + m->v_sync_width <= MODE_V_MAX_SYNC_LINES &&
+           m->v_back_porch <= MODE_V_MAX_BACK_PORCH;
+}
+
+bool video_mode_select(int mode) {
+    const bool usable = video_mode_usable(mode);
+    video_mode = modes[usable ? mode : MODE];
+
+    const uint32_t hsync[LINE_HSYNC_WORDS] = {
+        HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH, SYNC_V1_H1, HSTX_CMD_NOP,
+        HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,  SYNC_V1_H0, HSTX_CMD_NOP,
+        HSTX_CMD_RAW_REPEAT | MODE_H_BACK_PORCH,  SYNC_V1_H1};
+    for (int i = 0; i < LINE_HSYNC_WORDS; i++) {
+        line_hsync[i] = hsync[i];
+    }
+    return usable;
+}
+
+int video_mode_next(int mode) {
+    for (int i = 1; i < MODE_COUNT; i++) {
+        const int next = (mode + i) % MODE_COUNT;
+        if (video_mode_usable(next)) {
+            return next;
+        }
+    }
+    return MODE;
+}
@@ -23,119 +23,112 @@ AtomHDMI. If not, see <https://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #define MODE_800x600_60 1
 #define MODE_720x576_60 2
 #define MODE_640x480_60 3
 #define MODE_640x480_60_FAST 4
 #define MODE_640x480_60_FAST_DMT 5
+#define MODE_COUNT 6
 
-// MODE is defined in CMakeLists.txt
-#ifdef TELETEXT
-#define MODE MODE_720x576_60
-#endif
-
+// The video mode is chosen at boot from the modes drawn at the same scale,
+// see video_mode_select(). MODE, defined in CMakeLists.txt, is the mode used
+// when none has been saved and sets the scale, so a build either has the
+// 2x modes, 640x480 and 720x576, or the 3x 800x600.
 #if (MODE == MODE_800x600_60)
-#define MODE_H_SYNC_POLARITY 1
-#define MODE_H_FRONT_PORCH 40
-#define MODE_H_SYNC_WIDTH 128
-#define MODE_H_BACK_PORCH 88
-#define MODE_H_ACTIVE_PIXELS 800
-
-#define MODE_V_SYNC_POLARITY 1
-#define MODE_V_FRONT_PORCH 1
-#define MODE_V_SYNC_WIDTH 4
-#define MODE_V_BACK_PORCH 23
-#define MODE_V_ACTIVE_LINES 600
-
-#define XSCALE 2
-#define YSCALE 2
-
-#define REQUIRED_SYS_CLK_KHZ 200000
-#define HSTX_CLK_KHZ 200000
-
-#elif (MODE == MODE_720x576_60)
-#define MODE_H_SYNC_POLARITY 1
-#define MODE_H_FRONT_PORCH 48
-#define MODE_H_SYNC_WIDTH 32
-#define MODE_H_BACK_PORCH 80
-#define MODE_H_ACTIVE_PIXELS 720
-
-#define MODE_V_SYNC_POLARITY 0
-#define MODE_V_FRONT_PORCH 3
-#define MODE_V_SYNC_WIDTH 7
-#define MODE_V_BACK_PORCH 7
-#define MODE_V_ACTIVE_LINES 576
-
-#define XSCALE 2
-#define YSCALE 2
-
-#define REQUIRED_SYS_CLK_KHZ 156000
-#define HSTX_CLK_KHZ 156000
-
-#elif (MODE == MODE_640x480_60)
-#define MODE_H_SYNC_POLARITY 0
-#define MODE_H_FRONT_PORCH 16
-#define MODE_H_SYNC_WIDTH 96
-#define MODE_H_BACK_PORCH 48
-#define MODE_H_ACTIVE_PIXELS 640
-
-#define MODE_V_SYNC_POLARITY 0
-#define MODE_V_FRONT_PORCH 10
-#define MODE_V_SYNC_WIDTH 2
-#define MODE_V_BACK_PORCH 33
-#define MODE_V_ACTIVE_LINES 480
-
+// 256 x 192 at 3x is 768 x 576. A line is 1056 pixels at 40 MHz, 5280
+// cycles at 200 MHz, and each 6847 line is drawn once for 3 output lines,
+// so there are 15840 cycles to draw it, about the 16000 of 2x at 640x480.
+#define XSCALE 3
+#define YSCALE 3
+#define MODE_H_MAX_PIXELS 800
+#define MODE_V_MAX_LINES 600
+
+#elif (MODE == MODE_720x576_60 || MODE == MODE_640x480_60 || \
+       MODE == MODE_640x480_60_FAST || MODE == MODE_640x480_60_FAST_DMT)
 #define XSCALE 2
 #define YSCALE 2
+#define MODE_H_MAX_PIXELS 720
+#define MODE_V_MAX_LINES 576
 
-#define REQUIRED_SYS_CLK_KHZ 125000
-#define HSTX_CLK_KHZ 125000
+#else
+#error "Bad MODE"
 
-#elif (MODE == MODE_640x480_60_FAST)
-#define MODE_H_SYNC_POLARITY 0
-#define MODE_H_FRONT_PORCH 16
-#define MODE_H_SYNC_WIDTH 96
-#define MODE_H_BACK_PORCH 48
-#define MODE_H_ACTIVE_PIXELS 640
+#endif
 
-#define MODE_V_SYNC_POLARITY 0
-#define MODE_V_FRONT_PORCH 10
-#define MODE_V_SYNC_WIDTH 2
-#define MODE_V_BACK_PORCH 33
-#define MODE_V_ACTIVE_LINES 480
+// the most vertical blanking lines of any mode, for the HSTX command lists
+#define MODE_V_MAX_SYNC_LINES 12
+#define MODE_V_MAX_BACK_PORCH 33
+
+/// @brief the timing of a video mode and the clocks it is sent with
+struct video_mode {
+    const char* name;
+    uint16_t h_front_porch;
+    uint16_t h_sync_width;
+    uint16_t h_back_porch;
+    uint16_t h_active_pixels;
+    uint16_t v_front_porch;
+    uint16_t v_sync_width;
+    uint16_t v_back_porch;
+    uint16_t v_active_lines;
+    uint8_t scale;  ///< XSCALE and YSCALE of a build that can use the mode
+    uint32_t sys_clk_khz;
+    uint32_t hstx_clk_khz;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-#define XSCALE 2
-#define YSCALE 2
+// the mode in use, only changed before the scanout starts
+extern struct video_mode video_mode;
 
-#define REQUIRED_SYS_CLK_KHZ 250000
-#define HSTX_CLK_KHZ 125000
+/// @brief get a mode's timing
+/// @param mode one of the MODE_ values
+/// @return the timing, NULL if there is no such mode
+const struct video_mode* video_mode_get(int mode);
 
-#elif (MODE == MODE_640x480_60_FAST_DMT)
-#define MODE_H_SYNC_POLARITY 0
-#define MODE_H_FRONT_PORCH 8
-#define MODE_H_SYNC_WIDTH 96
-#define MODE_H_BACK_PORCH 40
-#define MODE_H_ACTIVE_PIXELS 640
+/// @brief check a mode can be used by this build
+/// @param mode one of the MODE_ values
+/// @return true if it is drawn at this build's scale and fits the buffers
+bool video_mode_usable(int mode);
 
-#define MODE_V_SYNC_POLARITY 0
-#define MODE_V_FRONT_PORCH 2
-#define MODE_V_SYNC_WIDTH 2
-#define MODE_V_BACK_PORCH 25
-#define MODE_V_ACTIVE_LINES 480
+/// @brief use a mode, before the clocks are set and the scanout started
+/// @param mode one of the MODE_ values
+/// @return false if the mode cannot be used, and MODE is used instead
+bool video_mode_select(int mode);
 
-#define XSCALE 2
-#define YSCALE 2
+/// @brief get the next usable mode, for stepping through them
+/// @param mode one of the MODE_ values
+/// @return the next usable mode after it, going round to the first
+int video_mode_next(int mode);
 
-#define REQUIRED_SYS_CLK_KHZ 250000
-#define HSTX_CLK_KHZ 125000
+#ifdef __cplusplus
+}
+#endif
 
-#else
-#error "Bad MODE"
+#define MODE_H_FRONT_PORCH (video_mode.h_front_porch)
+#define MODE_H_SYNC_WIDTH (video_mode.h_sync_width)
+#define MODE_H_BACK_PORCH (video_mode.h_back_porch)
+#define MODE_H_ACTIVE_PIXELS (video_mode.h_active_pixels)
+#define MODE_V_FRONT_PORCH (video_mode.v_front_porch)
+#define MODE_V_SYNC_WIDTH (video_mode.v_sync_width)
+#define MODE_V_BACK_PORCH (video_mode.v_back_porch)
+#define MODE_V_ACTIVE_LINES (video_mode.v_active_lines)
 
-#endif
+#define REQUIRED_SYS_CLK_KHZ (video_mode.sys_clk_khz)
+#define HSTX_CLK_KHZ (video_mode.hstx_clk_khz)
 
 typedef unsigned char pixel_t;
+#if PACKED_PIXELS
+// two 4 bit pixels, see hstx_line.h
+typedef unsigned char pixel2_t;
+static const int pixel_bits = 4;
+#else
 typedef unsigned short pixel2_t;
 static const int pixel_bits = 8;
+#endif
 
 